@@ -6,18 +6,102 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <algorithm>
+#include <cmath>
 
 //command line command:
 //g++ -std=c++17 -O2 -pthread cuckooHash.cpp -o cuckoo_hash
 
+// SipHash-1-3 (1 compression round, 3 finalization rounds) with a 128 bit key.
+// Used instead of std::hash ^ seed when the keys may be chosen by an adversary.
+static inline uint64_t rotl64(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);
+    v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);
+}
+
+static uint64_t siphash13(const void* data, size_t len, uint64_t k0, uint64_t k1) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+    uint64_t v3 = 0x7465646279746573ull ^ k1;
+    size_t full = len & ~(size_t)7;
+    for (size_t i = 0; i < full; i += 8) {
+        uint64_t m;
+        std::memcpy(&m, p + i, 8);
+        v3 ^= m;
+        sip_round(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t b = (uint64_t)len << 56;
+    for (size_t i = 0; i < (len & 7); i++) b |= (uint64_t)p[full + i] << (8 * i);
+    v3 ^= b;
+    sip_round(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Keyed hash of the key's bytes (integers, strings), or of std::hash for anything else.
+// Only the first two are flood-resistant: for other T the key sees std::hash's output,
+// so keys that collide under std::hash collide under every sip_key as well.
+template <typename T>
+uint64_t keyed_hash(const T& x, uint64_t k0, uint64_t k1) {
+    if constexpr (std::is_integral<T>::value) {
+        return siphash13(&x, sizeof(T), k0, k1);
+    } else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+        std::string_view v = x;
+        return siphash13(v.data(), v.size(), k0, k1);
+    } else {
+        size_t h = std::hash<T>{}(x);
+        return siphash13(&h, sizeof(h), k0, k1);
+    }
+}
+
 template <typename T>
 class CuckooHashSet {
 private:
     int LIMIT; // Max displacements before resize
     int table_size;
+
+    // A failed kick loop below this load (elements / slots) is blamed on the seeds:
+    // the table is reseeded in place instead of doubled. Two table, one slot cuckoo
+    // hashing only fills to about 50%.
+    static constexpr double REHASH_LOAD = 0.4;
+    static constexpr int MAX_REHASHES = 4; // reseeds allowed per table size before growing anyway
+    int rehash_budget = MAX_REHASHES;
+
+    // Hash flooding defense: with std::hash ^ seed, keys sharing their low bits share
+    // both buckets for every seed, so reseeding cannot help. After FLOOD_FAILURES sparse
+    // failures at one table size the set switches to SipHash keyed by (seed, sip_key).
+    static constexpr int FLOOD_FAILURES = 3;
+    int sparse_failures = 0;
+    bool keyed = false;
+    uint64_t sip_key = 0;
     std::vector<std::optional<T>> table0;
     std::vector<std::optional<T>> table1;
 
+    // Partial-key mode, for large keys: every slot also keeps a 32 bit tag (the key's hash
+    // under seed). Both buckets come from the tag alone, i0 = tag % n and
+    // i1 = (g(tag) - i0) mod n, so kicks and split resize never read a key, and lookups
+    // only compare keys whose tag matches. Empty unless partial_keys is set.
+    bool partial_keys;
+    std::vector<uint32_t> tags0;
+    std::vector<uint32_t> tags1;
+
     // Random seeds for the two hash functions
     size_t seed, seed1;
 
@@ -26,72 +110,233 @@ private:
 
     std::hash<T> hasher;
 
+    uint32_t tag_of(const T& x) const {
+        if (keyed) return (uint32_t)keyed_hash(x, seed, sip_key);
+        return (uint32_t)(hasher(x) ^ seed);
+    }
+
+    static uint32_t fmix32(uint32_t h) { // murmur3 finalizer
+        h ^= h >> 16; h *= 0x85ebca6b;
+        h ^= h >> 13; h *= 0xc2b2ae35;
+        return h ^ (h >> 16);
+    }
+
+    int tag_bucket0(uint32_t tag) const {
+        return tag % table_size;
+    }
+
+    // (a - b) mod n keeps the split resize property: modulo 2n it is either i1 or i1 + n
+    int tag_bucket1(uint32_t tag) const {
+        int g = fmix32(tag ^ (uint32_t)seed1) % table_size;
+        return (g - tag_bucket0(tag) + table_size) % table_size;
+    }
+
     int hash0(const T& x) const {
+        if (partial_keys) return tag_bucket0(tag_of(x));
+        if (keyed) return keyed_hash(x, seed, sip_key) % table_size;
         return (hasher(x)  ^ seed) % table_size; //return hash(x) % table_size
         // was return ((hasher(x) * table_size )^ seed) % table_size; //return hash(x) % table_size - problem was multiplying iyt by table_size!!
     }
 
     int hash1(const T& x) const {
+        if (partial_keys) return tag_bucket1(tag_of(x));
+        if (keyed) return keyed_hash(x, seed1, sip_key) % table_size;
         return (hasher(x) ^ seed1) % table_size; //used xor for better randomness / could bit shift too to mess iwth it << 5 -problem was multiplying iyt by table_size!!
         // was return ((hasher(x) * table_size )^ seed1) % table_size; //return hash(x) % table_size
     }
 
-    std::optional<T> swap(int table_index, int pos, const T& x) { //used optional incase return null value
-        std::optional<T> old;
-        if (table_index == 0) {
-            old = table0[pos];
-            table0[pos] = x;
+    // Put item (and its tag) into its bucket in table_index and hand back whatever was
+    // there. Moves instead of copies, so a kick never copies a key.
+    bool swap(int table_index, std::optional<T>& item, uint32_t& tag) {
+        std::vector<std::optional<T>>& table = (table_index == 0) ? table0 : table1;
+        int pos;
+        if (partial_keys) {
+            pos = (table_index == 0) ? tag_bucket0(tag) : tag_bucket1(tag);
+            std::swap(tag, (table_index == 0 ? tags0 : tags1)[pos]);
         } else {
-            old = table1[pos];
-            table1[pos] = x;
+            pos = (table_index == 0) ? hash0(*item) : hash1(*item);
         }
-        //std::cout << *old << std::endl;
-        return old;
+        std::swap(item, table[pos]);
+        return item.has_value(); //true if someone was kicked out
     }
 
-    // Rehash all elements into a new table with larger size
+    // Bucket of the element stored at pos under the current table_size
+    int bucket_of(int table_index, int pos) const {
+        if (partial_keys) return (table_index == 0) ? tag_bucket0(tags0[pos]) : tag_bucket1(tags1[pos]);
+        return (table_index == 0) ? hash0(*table0[pos]) : hash1(*table1[pos]);
+    }
+
+    // Double the table by splitting buckets. Since (h % 2n) is either (h % n) or
+    // (h % n) + n, every element either stays in its bucket b or moves to b + n, which
+    // is empty. No reseed, no kick chains, and it can never fail.
     void resize() {
         //if (table_size > 1'000'000) { // safety limit warning since reached this
         std::cerr << "Resize\n";
             //return;
         //}
-        //int temp_size = table_size;
+        int old_size = table_size;
         table_size = table_size * 2;
 
-        // Save old elements
-        std::vector<std::optional<T>> temp0 = std::move(table0);
-        std::vector<std::optional<T>> temp1 = std::move(table1);
+        // Grow in place, the new upper halves start empty
+        table0.resize(table_size);
+        table1.resize(table_size);
+        if (partial_keys) {
+            tags0.resize(table_size);
+            tags1.resize(table_size);
+        }
 
-        // Create new empty tables
-        table0.assign(table_size, std::nullopt);
-        table1.assign(table_size, std::nullopt);
+        for (int b = 0; b < old_size; b++) {
+            if (table0[b].has_value() && bucket_of(0, b) != b) {
+                table0[b + old_size] = std::move(table0[b]);
+                table0[b].reset();
+                if (partial_keys) tags0[b + old_size] = tags0[b];
+            }
+            if (table1[b].has_value() && bucket_of(1, b) != b) {
+                table1[b + old_size] = std::move(table1[b]);
+                table1[b].reset();
+                if (partial_keys) tags1[b + old_size] = tags1[b];
+            }
+        }
+        rehash_budget = MAX_REHASHES;
+        sparse_failures = 0;
+    }
 
-        // Reseed hash functions
+    // Pick new seeds and move every element to a home under them inside the existing
+    // arrays. placed0/placed1 mark slots filled under the new seeds: kicking out a
+    // placed element sends it to its other table as usual, kicking out an unplaced one
+    // just makes it the next element to insert. The few elements whose kick chain
+    // exceeds LIMIT end up in stash, everything else is consistent with the new seeds.
+    void rehash(std::vector<T>& stash) {
+        std::cerr << "Rehash\n";
         std::uniform_int_distribution<size_t> dist;
         seed = dist(rng);
         seed1 = dist(rng);
 
-        // Reinsert all elements
-        for (auto& i : temp0) {
-            if (i.has_value()) {
-                add(*i);
-                //print();
+        std::vector<bool> placed0(table_size, false), placed1(table_size, false);
+        for (int t = 0; t < 2; t++) {
+            std::vector<std::optional<T>>& from = (t == 0) ? table0 : table1;
+            std::vector<bool>& from_placed = (t == 0) ? placed0 : placed1;
+            for (int p = 0; p < table_size; p++) {
+                if (!from[p].has_value() || from_placed[p]) continue;
+                std::optional<T> x = std::move(from[p]);
+                from[p].reset();
+                int side = 0;
+                for (int i = 0; i < 2 * LIMIT && x.has_value(); i++) {
+                    int pos = (side == 0) ? hash0(*x) : hash1(*x);
+                    std::vector<std::optional<T>>& tbl = (side == 0) ? table0 : table1;
+                    std::vector<bool>& placed = (side == 0) ? placed0 : placed1;
+                    bool was_placed = placed[pos];
+                    std::swap(x, tbl[pos]);
+                    placed[pos] = true;
+                    side = was_placed ? 1 - side : 0;
+                }
+                if (x.has_value()) stash.push_back(std::move(*x));
             }
         }
-        for (auto& i : temp1) {
-            if (i.has_value()) {
-                add(*i);
-                //print();
+        // New seeds mean new tags, the one place partial-key mode reads every key
+        if (partial_keys) {
+            for (int p = 0; p < table_size; p++) {
+                if (table0[p].has_value()) tags0[p] = tag_of(*table0[p]);
+                if (table1[p].has_value()) tags1[p] = tag_of(*table1[p]);
             }
         }
     }
 
+    static constexpr int SCAN_BATCH = 256; // elements per contains_batch() call in set algebra
+
+    // Split the slots of both tables of from into num_threads ranges and call
+    // fn(thread, elements, count) with batches of the elements found in each range
+    template <typename Fn>
+    static void for_each_chunked(const CuckooHashSet& from, int num_threads, Fn fn) {
+        long total = 2L * from.table_size;
+        std::vector<std::thread> workers;
+        for (int t = 0; t < num_threads; t++) {
+            workers.emplace_back([&, t]() {
+                std::vector<T> batch;
+                batch.reserve(SCAN_BATCH);
+                for (long slot = total * t / num_threads; slot < total * (t + 1) / num_threads; slot++) {
+                    const std::optional<T>& x = slot < from.table_size ? from.table0[slot] : from.table1[slot - from.table_size];
+                    if (!x.has_value()) continue;
+                    batch.push_back(*x);
+                    if ((int)batch.size() == SCAN_BATCH) {
+                        fn(t, batch.data(), SCAN_BATCH);
+                        batch.clear();
+                    }
+                }
+                if (!batch.empty()) fn(t, batch.data(), (int)batch.size());
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+
+    // emit(thread, x) for every x of from whose membership in into equals want
+    template <typename Emit>
+    static void probe_chunks(const CuckooHashSet& from, const CuckooHashSet& into, bool want,
+                             int num_threads, Emit emit) {
+        for_each_chunked(from, num_threads, [&](int t, const T* xs, int n) {
+            bool hit[SCAN_BATCH];
+            into.contains_batch(xs, n, hit);
+            for (int k = 0; k < n; k++) if (hit[k] == want) emit(t, xs[k]);
+        });
+    }
+
+    // Gather a stream_ result into a new set sized for it
+    template <typename Run>
+    CuckooHashSet collect(Run run, int num_threads) const {
+        std::vector<std::vector<T>> found(num_threads);
+        run([&](int t, const T& x) { found[t].push_back(x); });
+        size_t count = 0;
+        for (auto& part : found) count += part.size();
+        CuckooHashSet result(std::max<int>(16, count + count / 4), LIMIT, partial_keys); // load ~0.4
+        for (auto& part : found)
+            for (auto& x : part) result.add(x);
+        return result;
+    }
+
+    void reseed_in_place() {
+        std::vector<T> stash;
+        rehash(stash);
+        for (auto& y : stash) add(y);
+    }
+
+    void switch_to_keyed_hash() {
+        keyed = true;
+        sip_key = std::uniform_int_distribution<uint64_t>{}(rng);
+    }
+
+    // Called when a kick loop fails: reseed while the table is sparse, grow when it is
+    // full. Repeated sparse failures look like a flood and switch to the keyed hash.
+    void make_room() {
+        bool sparse = size() < REHASH_LOAD * 2 * table_size;
+        if (sparse && !keyed && ++sparse_failures >= FLOOD_FAILURES) {
+            std::cerr << "Kick failures at low load, switching to keyed hash\n";
+            switch_to_keyed_hash();
+            reseed_in_place();
+        } else if (sparse && rehash_budget > 0) {
+            rehash_budget--;
+            reseed_in_place();
+        } else {
+            resize();
+        }
+    }
+
 public:
-    CuckooHashSet(int size, int limit) //constructor
+    // Hash with SipHash from now on, for untrusted keys (the switch also happens by itself
+    // when an attack is detected). Existing elements are rehashed in place.
+    void use_keyed_hash() {
+        if (keyed) return;
+        switch_to_keyed_hash();
+        reseed_in_place();
+    }
+
+    CuckooHashSet(int size, int limit, bool partial_keys = false) //constructor
         : table_size(size),
         LIMIT(limit),
         table0(size),
         table1(size),
+        partial_keys(partial_keys),
+        tags0(partial_keys ? size : 0),
+        tags1(partial_keys ? size : 0),
         rng(std::mt19937(std::random_device{}())) {
 
         std::uniform_int_distribution<size_t> dist;
@@ -101,6 +346,13 @@ public:
 
 
     bool contains(const T& x) const {
+        if (partial_keys) { // a key is only read when its tag matches
+            uint32_t tag = tag_of(x);
+            int p0 = tag_bucket0(tag);
+            int p1 = tag_bucket1(tag);
+            return (tags0[p0] == tag && table0[p0] && *table0[p0] == x) ||
+                   (tags1[p1] == tag && table1[p1] && *table1[p1] == x);
+        }
         return ((table0[hash0(x)] && *table0[hash0(x)] == x) ||
                (table1[hash1(x)] && *table1[hash1(x)] == x));
     }
@@ -110,41 +362,111 @@ public:
             return false;
         }
         //T ret_x = x;
-        T loop_x = x;
-        for (int i = 0; i < LIMIT; i++) {
-            auto new_x = swap(0, hash0(loop_x), loop_x);
-            if (!(new_x.has_value())){
-                return true;
-            }
-            auto new_new_x = swap(1, hash1(*new_x), *new_x);
-            if (!(new_new_x.has_value())) {
-                return true;
+        std::optional<T> loop_x = x;
+        uint32_t loop_tag = partial_keys ? tag_of(x) : 0;
+        while (true) { // loop instead of recursing, a hostile key stream can fail many times
+            for (int i = 0; i < LIMIT; i++) {
+                if (!swap(0, loop_x, loop_tag)) {
+                    return true;
+                }
+                if (!swap(1, loop_x, loop_tag)) {
+                    return true;
+                }
+                //ret_x = *loop_x;
             }
-            loop_x = *new_new_x;
-            //ret_x = *new_new_x;
+            // Too many displacements — reseed or resize and try again with the homeless element
+            //std::cout << ret_x << std::endl;
+            //print();
+            make_room();
+            if (partial_keys) loop_tag = tag_of(*loop_x); // a reseed changes tags
         }
-        // Too many displacements — resize and try again
-        //std::cout << ret_x << std::endl;
-        //print();
-        resize();
-        return add(loop_x);
     }
 
     bool remove(const T& x) {
         ///if (!contains(x)){
         //    return false;
         //}
-        if (table0[hash0(x)] && *table0[hash0(x)] == x) {
-            table0[hash0(x)].reset();
+        int h0 = hash0(x);
+        if (table0[h0] && *table0[h0] == x) {
+            table0[h0].reset();
             return true;
         }
-        if (table1[hash1(x)] && *table1[hash1(x)] == x) {
-            table1[hash1(x)].reset();
+        int h1 = hash1(x);
+        if (table1[h1] && *table1[h1] == x) {
+            table1[h1].reset();
             return true;
         }
         return false;
     }
 
+    // Look up n keys at once: both buckets of a group of keys are computed and prefetched
+    // before any of them is compared, so the cache misses of the group overlap
+    void contains_batch(const T* keys, int n, bool* out) const {
+        constexpr int GROUP = 16;
+        int p0[GROUP], p1[GROUP];
+        for (int base = 0; base < n; base += GROUP) {
+            int m = std::min(GROUP, n - base);
+            for (int k = 0; k < m; k++) {
+                p0[k] = hash0(keys[base + k]);
+                p1[k] = hash1(keys[base + k]);
+                __builtin_prefetch(&table0[p0[k]]);
+                __builtin_prefetch(&table1[p1[k]]);
+            }
+            for (int k = 0; k < m; k++) {
+                const T& x = keys[base + k];
+                out[base + k] = (table0[p0[k]] && *table0[p0[k]] == x) ||
+                                (table1[p1[k]] && *table1[p1[k]] == x);
+            }
+        }
+    }
+
+    // Set algebra. The stream_ versions call emit(thread, x) for every result element
+    // from num_threads workers (emit must cope with that), the others build a new set.
+    // Intersection and union walk the smaller set and probe the larger one; difference
+    // has to walk this set. Neither set may be modified while these run.
+    template <typename Emit>
+    void stream_intersection(const CuckooHashSet& other, int num_threads, Emit emit) const {
+        const CuckooHashSet& small = size() <= other.size() ? *this : other;
+        const CuckooHashSet& large = size() <= other.size() ? other : *this;
+        probe_chunks(small, large, true, num_threads, emit);
+    }
+
+    template <typename Emit>
+    void stream_difference(const CuckooHashSet& other, int num_threads, Emit emit) const {
+        probe_chunks(*this, other, false, num_threads, emit);
+    }
+
+    // All of the larger set, then what the smaller set adds to it
+    template <typename Emit>
+    void stream_union(const CuckooHashSet& other, int num_threads, Emit emit) const {
+        const CuckooHashSet& small = size() <= other.size() ? *this : other;
+        const CuckooHashSet& large = size() <= other.size() ? other : *this;
+        for_each_chunked(large, num_threads, [&](int t, const T* xs, int n) {
+            for (int k = 0; k < n; k++) emit(t, xs[k]);
+        });
+        probe_chunks(small, large, false, num_threads, emit);
+    }
+
+    CuckooHashSet set_intersection(const CuckooHashSet& other, int num_threads = 1) const {
+        return collect([&](auto emit) { stream_intersection(other, num_threads, emit); }, num_threads);
+    }
+
+    CuckooHashSet set_difference(const CuckooHashSet& other, int num_threads = 1) const {
+        return collect([&](auto emit) { stream_difference(other, num_threads, emit); }, num_threads);
+    }
+
+    // Starts from a copy of the larger set, so only the smaller one's extras are inserted
+    CuckooHashSet set_union(const CuckooHashSet& other, int num_threads = 1) const {
+        const CuckooHashSet& small = size() <= other.size() ? *this : other;
+        const CuckooHashSet& large = size() <= other.size() ? other : *this;
+        std::vector<std::vector<T>> found(num_threads);
+        probe_chunks(small, large, false, num_threads, [&](int t, const T& x) { found[t].push_back(x); });
+        CuckooHashSet result = large;
+        for (auto& part : found)
+            for (auto& x : part) result.add(x);
+        return result;
+    }
+
     int size() const {
         int count = 0;
         for (auto& i : table0) if (i.has_value()) count++;
@@ -184,6 +506,191 @@ public:
     }
 };
 
+// Two tier set for skewed lookups: a small hot tier, sized to stay in cache, in front of
+// a large cold CuckooHashSet. Every key lives in exactly one tier. The hot tier is not a
+// cuckoo table but a set-associative array: a power-of-two number of HOT_WAYS slot
+// buckets, found with one multiply and a shift (no modulo) and compared without
+// branches. It never kicks, reseeds or grows; a full bucket makes room by demoting its
+// coldest key. T must be default constructible (empty ways hold a default T).
+// Cold hits are counted in a small array of saturating counters indexed by hash, hot
+// keys count their hits in their own slot. A cold key that reaches PROMOTE_HITS moves to
+// the hot tier if its bucket has a free slot or a key with fewer hits. Every age_period
+// lookups all counts are halved and hot keys whose count has decayed to zero are
+// demoted. Like its tiers this is single threaded, so that demotion work is amortized
+// over the lookups instead of running on another thread.
+template <typename T>
+class TieredCuckooHashSet {
+private:
+    static constexpr int HOT_WAYS = 2;
+    static constexpr int PROMOTE_HITS = 8;
+
+    // hits[w] == 0 marks an empty way: a hot key has at least one hit, age() demotes it
+    // once its count decays to zero
+    struct HotBucket {
+        T keys[HOT_WAYS];
+        uint8_t hits[HOT_WAYS] = {};
+    };
+
+    std::vector<HotBucket> hot;
+    int hot_shift; // bucket = (hash * multiplier) >> hot_shift
+    CuckooHashSet<T> cold;
+    int hot_count = 0;
+    int cold_count = 0;
+
+    std::vector<uint8_t> hits;
+    int hits_shift;
+    long age_period;
+    long lookups = 0;
+    std::hash<T> hasher;
+    std::mt19937 rng;
+
+    long hot_hits = 0, cold_hits = 0, promotions = 0, demotions = 0;
+
+    HotBucket& hot_bucket(uint64_t h) {
+        return hot[(h * 0xff51afd7ed558ccdull) >> hot_shift];
+    }
+
+    // Way of x in its hot bucket, or -1. All ways are compared, an early exit would
+    // mispredict on the many lookups that hit the second way.
+    static int find_way(const HotBucket& b, const T& x) {
+        unsigned match = 0;
+        for (int w = 0; w < HOT_WAYS; w++) match |= (unsigned)((b.hits[w] != 0) & (b.keys[w] == x)) << w;
+        return match ? __builtin_ctz(match) : -1;
+    }
+
+    // Two counters per cold key (count-min): its hits are the smaller one, so a cold key
+    // that shares one counter with a hot key does not look hot itself
+    uint8_t& counter(uint64_t h, uint64_t mul) {
+        return hits[(h * mul) >> hits_shift];
+    }
+
+    int hit_count(uint64_t h) {
+        return std::min(counter(h, 0x9e3779b97f4a7c15ull), counter(h, 0xc2b2ae3d27d4eb4full));
+    }
+
+    // Only the counters at the minimum are raised (conservative update)
+    int record_hit(uint64_t h) {
+        uint8_t& a = counter(h, 0x9e3779b97f4a7c15ull);
+        uint8_t& b = counter(h, 0xc2b2ae3d27d4eb4full);
+        uint8_t m = std::min(a, b);
+        if (m == 255) return m;
+        if (a == m) a++;
+        if (b == m) b++;
+        return m + 1;
+    }
+
+    void demote(HotBucket& b, int w) {
+        cold.add(b.keys[w]);
+        b.hits[w] = 0;
+        hot_count--;
+        cold_count++;
+        demotions++;
+    }
+
+    // Move x into a free way of its bucket, or in place of a key with fewer hits
+    void promote(HotBucket& b, const T& x, int count) {
+        int victim = 0;
+        for (int w = 1; w < HOT_WAYS; w++) if (b.hits[w] < b.hits[victim]) victim = w;
+        if (b.hits[victim]) {
+            if (b.hits[victim] >= count) return; // the bucket's keys are all hotter
+            demote(b, victim);
+        }
+        cold.remove(x);
+        cold_count--;
+        b.keys[victim] = x;
+        b.hits[victim] = count;
+        hot_count++;
+        promotions++;
+    }
+
+    void age() {
+        for (auto& c : hits) c >>= 1;
+        for (auto& b : hot) {
+            for (int w = 0; w < HOT_WAYS; w++) {
+                if (b.hits[w] == 1) demote(b, w);
+                else b.hits[w] >>= 1;
+            }
+        }
+    }
+
+public:
+    // hot_size is the number of hot slots (rounded up to a power of two number of
+    // buckets), size is buckets per table of the cold tier
+    TieredCuckooHashSet(int hot_size, int size, int limit)
+        : cold(size, limit),
+          rng(std::mt19937(std::random_device{}())) {
+        int bits = 1;
+        while ((HOT_WAYS << bits) < hot_size) bits++;
+        hot.resize((size_t)1 << bits);
+        hot_shift = 64 - bits;
+        int hot_slots = HOT_WAYS << bits;
+        bits = 1;
+        while ((1 << bits) < 4 * hot_slots) bits++; // a few counter pairs per hot key
+        hits.assign((size_t)1 << bits, 0);
+        hits_shift = 64 - bits;
+        age_period = 10L * hot_slots;
+    }
+
+    bool contains(const T& x) {
+        if (++lookups == age_period) {
+            lookups = 0;
+            age();
+        }
+        uint64_t h = hasher(x);
+        HotBucket& b = hot_bucket(h);
+        int w = find_way(b, x);
+        if (w >= 0) {
+            if (b.hits[w] < 255) b.hits[w]++;
+            hot_hits++;
+            return true;
+        }
+        if (!cold.contains(x)) return false;
+        int c = record_hit(h);
+        cold_hits++;
+        if (c >= PROMOTE_HITS) promote(b, x, c);
+        return true;
+    }
+
+    // New keys start cold
+    bool add(const T& x) {
+        if (find_way(hot_bucket(hasher(x)), x) >= 0 || !cold.add(x)) return false;
+        cold_count++;
+        return true;
+    }
+
+    bool remove(const T& x) {
+        HotBucket& b = hot_bucket(hasher(x));
+        int w = find_way(b, x);
+        if (w >= 0) {
+            b.hits[w] = 0;
+            hot_count--;
+            return true;
+        }
+        if (cold.remove(x)) {
+            cold_count--;
+            return true;
+        }
+        return false;
+    }
+
+    int size() const {
+        return hot_count + cold_count;
+    }
+
+    void populate(int n) {
+        std::uniform_int_distribution<int> dist(0, n * 8);
+        for (int i = 0; i < n; ++i)
+            while (!add(dist(rng))) {}
+    }
+
+    void print_stats() const {
+        long found = hot_hits + cold_hits;
+        std::cout << "Hot tier:            " << hot_count << " keys (" << HOT_WAYS * hot.size() << " slots)\n";
+        std::cout << "Hot hit share:       " << (found ? (double)hot_hits / found : 0.0) << "\n";
+        std::cout << "Promotions:          " << promotions << ", demotions: " << demotions << "\n";
+    }
+};
+
 // Example usage:
 int main() {
     int initial_size = 1000000;     // starting table size 10k, 100k, 1M
@@ -193,8 +700,13 @@ int main() {
     double insert_ratio = 0.10;  // 10% insert
     double remove_ratio = 0.10;  // 10% remove
     double contains_ratio = 0.80;// 80% contains
+    bool keyed_hash = false;     // SipHash from the start, for untrusted keys
+    bool partial_keys = false;   // per-slot tags, kicks never read keys (for large keys)
+    bool set_algebra = false;    // time set_intersection against a contains() loop afterwards
+    bool tiered = false;         // skewed contains() stream on a plain set and on TieredCuckooHashSet
 
-    CuckooHashSet<int> set(initial_size, limit);
+    CuckooHashSet<int> set(initial_size, limit, partial_keys);
+    if (keyed_hash) set.use_keyed_hash();
     set.populate(initial_size * 0.5); // pre-populate 50% of table
     
      // Each thread performs total_ops / num_threads
@@ -246,6 +758,61 @@ int main() {
     std::cout << "Actual final size:   " << set.size() << "\n";
     std::cout << "Time taken:          " << duration.count() << " seconds\n";
 
+    if (set_algebra) {
+        CuckooHashSet<int> other(initial_size, limit, partial_keys);
+        other.populate(initial_size * 0.5);
+        auto loop_start = std::chrono::high_resolution_clock::now();
+        int common = 0;
+        for (int k = 0; k <= initial_size * 4; k++) common += set.contains(k) && other.contains(k);
+        std::chrono::duration<double> loop_time = std::chrono::high_resolution_clock::now() - loop_start;
+        auto algebra_start = std::chrono::high_resolution_clock::now();
+        CuckooHashSet<int> both = set.set_intersection(other, 4);
+        std::chrono::duration<double> algebra_time = std::chrono::high_resolution_clock::now() - algebra_start;
+        std::cout << "Intersection size:   " << both.size() << " (contains loop found " << common << ")\n";
+        std::cout << "contains() loop:     " << loop_time.count() << " seconds\n";
+        std::cout << "set_intersection():  " << algebra_time.count() << " seconds\n";
+    }
+
+    if (tiered) {
+        // Keys 0..n-1 scattered by an odd multiplier; lookups pick rank n * u^6, so the
+        // top 1% of ranks gets close to half of the traffic
+        int n = initial_size / 2;
+        auto key_of = [](int rank) { return (int)((uint32_t)rank * 2654435761u); };
+        CuckooHashSet<int> plain(initial_size, limit);
+        TieredCuckooHashSet<int> two_tier(16384, initial_size, limit);
+        for (int r = 0; r < n; r++) {
+            plain.add(key_of(r));
+            two_tier.add(key_of(r));
+        }
+        std::mt19937 rng(std::random_device{}());
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+        std::vector<int> stream(1 << 20);
+        for (auto& k : stream) k = key_of((int)(n * std::pow(u(rng), 6.0)));
+        long mask = stream.size() - 1;
+        for (int i = 0; i < total_ops; i++) two_tier.contains(stream[i & mask]); // warm the hot tier
+
+        // Independent lookups overlap their cache misses; in the dependent stream the next
+        // key is only known once the previous lookup returned, so every miss is paid in full
+        long found = 0;
+        auto timed = [&](auto& set, bool dependent) {
+            auto start = std::chrono::high_resolution_clock::now();
+            long j = 0;
+            for (int i = 0; i < total_ops; i++) {
+                bool f = set.contains(stream[j]);
+                found += f;
+                j = dependent ? (j + 1 + f) & mask : (i + 1) & mask;
+            }
+            return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        };
+        double plain_time = timed(plain, false), tiered_time = timed(two_tier, false);
+        double plain_dep = timed(plain, true), tiered_dep = timed(two_tier, true);
+
+        std::cout << "Skewed lookups found: " << found << " (four times " << total_ops << " expected)\n";
+        std::cout << "Plain contains():    " << plain_time << " seconds, dependent " << plain_dep << "\n";
+        std::cout << "Tiered contains():   " << tiered_time << " seconds, dependent " << tiered_dep << "\n";
+        two_tier.print_stats();
+    }
+
     return 0;
 }
 //command line command:
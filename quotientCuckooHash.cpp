@@ -0,0 +1,336 @@
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+
+// g++ -std=c++17 -O2 quotientCuckooHash.cpp -o quotient_cuckoo_hash
+
+// Cuckoo set of 32 or 64 bit integer keys that stores only part of every key. Keys go
+// through an invertible mix y = mix(x ^ seed); with 2^b buckets per table the low b bits
+// of y pick the table0 bucket i0 and only the quotient q = y >> b (KEY_BITS - b bits) is
+// stored. The table1 bucket is i1 = i0 ^ alt(q), which only needs q, so from a slot's
+// table, bucket and quotient the whole of y (and so x) comes back: lookups still match
+// keys exactly, and kicks and resizes work on quotients alone.
+//
+// Buckets have SLOTS slots (oldest first, like the striped probe sets) and a slot count,
+// packed back to back into a stream of 64 bit words (a bucket may straddle two words).
+// Doubling the table moves one bit from the quotient into the bucket index, so slots get
+// one bit narrower every time it grows: 32 bit keys in 2^20 buckets per table take 12
+// bits per slot and 51 bits per bucket.
+template <typename K>
+class QuotientCuckooHashSet {
+    static_assert(std::is_same<K, uint32_t>::value || std::is_same<K, uint64_t>::value,
+                  "keys are uint32_t or uint64_t");
+
+private:
+    static constexpr int KEY_BITS = 8 * sizeof(K);
+    static constexpr int SLOTS = 4;
+    static constexpr int COUNT_BITS = 3; // 0..SLOTS
+
+    int LIMIT;               // Max displacements before resize
+    int bucket_bits;         // b: 2^b buckets per table
+    uint64_t mask;           // 2^b - 1
+    int quotient_bits;       // KEY_BITS - b, bits per slot
+    size_t bucket_width;     // COUNT_BITS + SLOTS * quotient_bits
+    std::vector<uint64_t> table0;
+    std::vector<uint64_t> table1;
+    size_t num_elements = 0;
+    K seed;
+    std::mt19937_64 rng;
+
+    // murmur3 finalizers: xorshifts and odd multipliers, each step invertible
+    static constexpr K inverse(K a) { // a * inverse(a) == 1 mod 2^KEY_BITS, a odd
+        K x = a; // right in the low 3 bits, every Newton step doubles that
+        for (int i = 0; i < 5; i++) x *= K(2) - a * x;
+        return x;
+    }
+
+    static constexpr K M1 = KEY_BITS == 64 ? K(0xff51afd7ed558ccdull) : K(0x85ebca6bu);
+    static constexpr K M2 = KEY_BITS == 64 ? K(0xc4ceb9fe1a85ec53ull) : K(0xc2b2ae35u);
+    static constexpr int S1 = KEY_BITS == 64 ? 33 : 16;
+    static constexpr int S2 = KEY_BITS == 64 ? 33 : 13;
+    static constexpr int S3 = KEY_BITS == 64 ? 33 : 16;
+
+    static K unxorshift(K y, int s) {
+        K x = y;
+        for (int i = 0; i < KEY_BITS / s; i++) x = y ^ (x >> s);
+        return x;
+    }
+
+    K mix(K x) const {
+        K y = x ^ seed;
+        y ^= y >> S1; y *= M1;
+        y ^= y >> S2; y *= M2;
+        y ^= y >> S3;
+        return y;
+    }
+
+    K unmix(K y) const {
+        y = unxorshift(y, S3); y *= inverse(M2);
+        y = unxorshift(y, S2); y *= inverse(M1);
+        y = unxorshift(y, S1);
+        return y ^ seed;
+    }
+
+    // Offset from a quotient to the table1 bucket (and back, it is an xor)
+    uint64_t alt(uint64_t q) const {
+        q *= 0x9e3779b97f4a7c15ull;
+        return (q ^ (q >> 29)) & mask;
+    }
+
+    static uint64_t get_bits(const uint64_t* w, size_t off, int len) {
+        size_t i = off >> 6;
+        int sh = off & 63;
+        uint64_t v = w[i] >> sh;
+        if (sh + len > 64) v |= w[i + 1] << (64 - sh);
+        return len == 64 ? v : v & ((1ull << len) - 1);
+    }
+
+    static void set_bits(uint64_t* w, size_t off, int len, uint64_t v) {
+        size_t i = off >> 6;
+        int sh = off & 63;
+        uint64_t m = len == 64 ? ~0ull : (1ull << len) - 1;
+        w[i] = (w[i] & ~(m << sh)) | (v << sh);
+        if (sh + len > 64) {
+            int hi = sh + len - 64; // bits that spill into the next word
+            uint64_t hm = (1ull << hi) - 1;
+            w[i + 1] = (w[i + 1] & ~hm) | (v >> (64 - sh));
+        }
+    }
+
+    uint64_t* words(int t) {
+        return (t == 0 ? table0 : table1).data();
+    }
+
+    const uint64_t* words(int t) const {
+        return (t == 0 ? table0 : table1).data();
+    }
+
+    int count(int t, uint64_t i) const {
+        return (int)get_bits(words(t), i * bucket_width, COUNT_BITS);
+    }
+
+    void set_count(int t, uint64_t i, int c) {
+        set_bits(words(t), i * bucket_width, COUNT_BITS, c);
+    }
+
+    uint64_t slot(int t, uint64_t i, int k) const {
+        return get_bits(words(t), i * bucket_width + COUNT_BITS + k * quotient_bits, quotient_bits);
+    }
+
+    void set_slot(int t, uint64_t i, int k, uint64_t q) {
+        set_bits(words(t), i * bucket_width + COUNT_BITS + k * quotient_bits, quotient_bits, q);
+    }
+
+    int find(int t, uint64_t i, uint64_t q) const {
+        int c = count(t, i);
+        for (int k = 0; k < c; k++)
+            if (slot(t, i, k) == q) return k;
+        return -1;
+    }
+
+    void push_back(int t, uint64_t i, uint64_t q) {
+        int c = count(t, i);
+        set_slot(t, i, c, q);
+        set_count(t, i, c + 1);
+    }
+
+    void erase(int t, uint64_t i, int k) {
+        int c = count(t, i);
+        for (int m = k + 1; m < c; m++) set_slot(t, i, m - 1, slot(t, i, m));
+        set_count(t, i, c - 1);
+    }
+
+    uint64_t pop_front(int t, uint64_t i) {
+        uint64_t q = slot(t, i, 0);
+        erase(t, i, 0);
+        return q;
+    }
+
+    // The key stored as quotient q in bucket i of table t
+    K key_at(int t, uint64_t i, uint64_t q) const {
+        uint64_t i0 = (t == 0) ? i : (i ^ alt(q));
+        return unmix((K)((q << bucket_bits) | i0));
+    }
+
+    void set_geometry(int bits) {
+        bucket_bits = bits;
+        mask = (1ull << bits) - 1;
+        quotient_bits = KEY_BITS - bits;
+        bucket_width = COUNT_BITS + SLOTS * quotient_bits;
+        size_t num_words = ((bucket_width << bits) + 63) / 64 + 1; // + 1: reads of the last bucket may touch it
+        table0.assign(num_words, 0);
+        table1.assign(num_words, 0);
+    }
+
+    // Place quotient q for table0 bucket i0, kicking oldest entries to their other bucket.
+    // On failure the homeless key is returned in homeless and false comes back.
+    bool place(uint64_t i0, uint64_t q, K& homeless) {
+        if (count(0, i0) < SLOTS) { push_back(0, i0, q); return true; }
+        uint64_t i1 = i0 ^ alt(q);
+        if (count(1, i1) < SLOTS) { push_back(1, i1, q); return true; }
+        int t = 0;
+        uint64_t i = i0;
+        for (int round = 0; round < LIMIT; round++) {
+            uint64_t v = pop_front(t, i);
+            push_back(t, i, q);
+            q = v;
+            i ^= alt(v); // the victim's other bucket, in the other table
+            t = 1 - t;
+            if (count(t, i) < SLOTS) { push_back(t, i, q); return true; }
+        }
+        homeless = key_at(t, i, q);
+        return false;
+    }
+
+    void insert_new(K x) {
+        while (true) {
+            K y = mix(x);
+            K homeless;
+            if (place(y & mask, (uint64_t)(y >> bucket_bits), homeless)) return;
+            resize();
+            x = homeless;
+        }
+    }
+
+    // Double both tables: every key is decoded and placed again with a one bit narrower
+    // quotient. Needs the keys (8 or 4 bytes each) in memory for the duration.
+    void resize() {
+        std::cerr << "Resize\n";
+        std::vector<K> keys;
+        keys.reserve(num_elements);
+        for_each([&](K x) { keys.push_back(x); });
+        int bits = bucket_bits + 1;
+        while (true) {
+            if (bits >= KEY_BITS) throw std::length_error("quotient table cannot grow further");
+            set_geometry(bits);
+            bool ok = true;
+            for (K x : keys) {
+                K y = mix(x), homeless;
+                if (!place(y & mask, (uint64_t)(y >> bucket_bits), homeless)) { ok = false; break; }
+            }
+            if (ok) return;
+            bits++;
+        }
+    }
+
+public:
+    // size: buckets per table, rounded up to a power of two
+    QuotientCuckooHashSet(size_t size, int limit)
+        : LIMIT(limit),
+          rng(std::random_device{}()) {
+        int bits = 1;
+        while (((size_t)1 << bits) < size) bits++;
+        if (bits >= KEY_BITS) bits = KEY_BITS - 1;
+        seed = (K)rng();
+        set_geometry(bits);
+    }
+
+    bool contains(K x) const {
+        K y = mix(x);
+        uint64_t i0 = y & mask;
+        uint64_t q = (uint64_t)(y >> bucket_bits);
+        return find(0, i0, q) >= 0 || find(1, i0 ^ alt(q), q) >= 0;
+    }
+
+    bool add(K x) {
+        if (contains(x)) return false;
+        num_elements++;
+        insert_new(x);
+        return true;
+    }
+
+    bool remove(K x) {
+        K y = mix(x);
+        uint64_t i0 = y & mask;
+        uint64_t q = (uint64_t)(y >> bucket_bits);
+        for (int t = 0; t < 2; t++) {
+            uint64_t i = (t == 0) ? i0 : i0 ^ alt(q);
+            int k = find(t, i, q);
+            if (k >= 0) {
+                erase(t, i, k);
+                num_elements--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // fn(key) for every element, keys decoded from their slots
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (int t = 0; t < 2; t++)
+            for (uint64_t i = 0; i <= mask; i++)
+                for (int k = 0; k < count(t, i); k++) fn(key_at(t, i, slot(t, i, k)));
+    }
+
+    size_t size() const {
+        return num_elements;
+    }
+
+    size_t capacity() const {
+        return 2 * SLOTS * ((size_t)mask + 1);
+    }
+
+    size_t memory_bytes() const {
+        return (table0.size() + table1.size()) * sizeof(uint64_t);
+    }
+
+    int bits_per_slot() const {
+        return quotient_bits;
+    }
+};
+
+template <typename K>
+void run_benchmark(const char* label, size_t buckets, size_t n, int limit) {
+    QuotientCuckooHashSet<K> set(buckets, limit);
+    std::mt19937_64 rng(std::random_device{}());
+    std::vector<K> keys(n);
+    for (auto& k : keys) k = (K)rng();
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+    auto build_start = std::chrono::high_resolution_clock::now();
+    for (K k : keys) set.add(k);
+    std::chrono::duration<double> build_time = std::chrono::high_resolution_clock::now() - build_start;
+
+    // every key must come back, and random other keys must not
+    std::vector<K> sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<K> probes(keys.size());
+    for (auto& k : probes) k = (K)rng();
+    auto lookup_start = std::chrono::high_resolution_clock::now();
+    size_t found = 0, false_hits = 0;
+    for (K k : keys) found += set.contains(k);
+    for (K k : probes) false_hits += set.contains(k) && !std::binary_search(sorted.begin(), sorted.end(), k);
+    std::chrono::duration<double> lookup_time = std::chrono::high_resolution_clock::now() - lookup_start;
+
+    std::cout << label << "\n";
+    std::cout << "  Elements:          " << set.size() << " / " << set.capacity() << " slots\n";
+    std::cout << "  Bits per slot:     " << set.bits_per_slot() << " (key has " << 8 * sizeof(K) << ")\n";
+    std::cout << "  Bits per element:  " << 8.0 * set.memory_bytes() / set.size() << "\n";
+    std::cout << "  Found:             " << found << ", false hits: " << false_hits << "\n";
+    std::cout << "  Build time:        " << build_time.count() << " seconds\n";
+    std::cout << "  Lookup time:       " << lookup_time.count() << " seconds (" << 2 * keys.size() << " lookups)\n";
+}
+
+int main() {
+    size_t buckets = 1 << 20; // per table, 8M slots in total
+    size_t num_keys = 7000000;
+    int limit = 500;
+
+    std::cout << "Starting benchmark test(s)...\n";
+    run_benchmark<uint32_t>("uint32_t keys", buckets, num_keys, limit);
+    run_benchmark<uint64_t>("uint64_t keys", buckets, num_keys, limit);
+    std::cout << "Benchmark test(s) complete.\n";
+    return 0;
+}
+
+// g++ -std=c++17 -O2 quotientCuckooHash.cpp -o quotient_cuckoo_hash
+// ./quotient_cuckoo_hash
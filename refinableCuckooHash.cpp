@@ -0,0 +1,526 @@
+#include <vector>
+#include <functional>
+#include <random>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <algorithm>
+
+// g++ -std=c++17 -O2 -pthread refinableCuckooHash.cpp -o refinable_cuckoo_hash
+
+// Refinable cuckoo hash set (Herlihy & Shavit, Fig. 13.30-13.32). Probe sets, THRESHOLD /
+// PROBE_SIZE and relocation are the same as StripedCuckooHashSet, but the lock arrays are
+// published through an atomic pointer together with an owner marker. A thread that sets
+// the owner can swap in a bigger lock array (refine) or a resized table without stopping
+// anyone outside of a short quiesce, so the number of stripes can follow contention.
+template <typename T>
+class RefinableCuckooHashSet {
+private:
+    // One published lock array. It also carries the table size and seeds, so a thread that
+    // validated its locks against the current array is hashing with the current layout.
+    struct LockArray {
+        std::vector<std::mutex> locks0;
+        std::vector<std::mutex> locks1;
+        int table_size;
+        size_t seed, seed1;
+
+        LockArray(int num_locks, int size, size_t s0, size_t s1)
+            : locks0(num_locks), locks1(num_locks), table_size(size), seed(s0), seed1(s1) {}
+    };
+
+    // Locks held by one acquire(), released with release()
+    struct Held {
+        LockArray* L;
+        std::mutex* l0;
+        std::mutex* l1;
+    };
+
+    int LIMIT;            // Max displacements before resize
+    int PROBE_SIZE;       // Max elements per bucket
+    int THRESHOLD;        // Threshold of when to relocate
+    int CONTENTION_LIMIT; // Contended lock acquisitions before the lock array is refined
+
+    // Out of room below this load (elements / slots): reseed in place instead of doubling
+    static constexpr double REHASH_LOAD = 0.4;
+    static constexpr int MAX_REHASHES = 4; // reseeds allowed per table size
+    int rehash_budget = MAX_REHASHES;      // only touched by the owner
+    std::vector<std::list<T>> table0;
+    std::vector<std::list<T>> table1;
+
+    std::atomic<LockArray*> locks;
+    // Arrays replaced by refine/resize. A thread can still be spinning on one of them
+    // (it will fail validation and retry), so they are only freed with the set.
+    std::vector<std::unique_ptr<LockArray>> retired;
+    // Marked (not the empty id) while a thread is refining or resizing
+    std::atomic<std::thread::id> owner;
+    std::atomic<int> contention{0};
+
+    // Bucket arrays for resize() are built before taking ownership, so their page faults
+    // do not stall the other threads; unused or replaced arrays are pooled for reuse
+    static constexpr size_t MAX_SPARE_TABLES = 4;
+    std::mutex spare_mutex;
+    std::vector<std::vector<std::list<T>>> spare_tables;
+
+    std::mt19937 rng;
+    std::hash<T> hasher;
+
+    int hash0(const LockArray* L, const T& x) const {
+        return (hasher(x) ^ L->seed) % L->table_size;
+    }
+
+    int hash1(const LockArray* L, const T& x) const {
+        return (hasher(x) ^ L->seed1) % L->table_size;
+    }
+
+    void lock_counted(std::mutex& m) {
+        if (!m.try_lock()) {
+            contention.fetch_add(1, std::memory_order_relaxed);
+            m.lock();
+        }
+    }
+
+    // Wait until no other thread owns the set
+    void wait_for_owner() {
+        std::thread::id me = std::this_thread::get_id();
+        std::thread::id who;
+        while ((who = owner.load()) != std::thread::id() && who != me) std::this_thread::yield();
+    }
+
+    // Lock and validate: nobody else owns the set and the array we locked is still current
+    bool validate(LockArray* L) {
+        std::thread::id who = owner.load();
+        return (who == std::thread::id() || who == std::this_thread::get_id()) && locks.load() == L;
+    }
+
+    // Lock both buckets for an element (table 0 first, to avoid deadlock) (Fig. 13.31)
+    Held acquire(const T& x) {
+        while (true) {
+            wait_for_owner();
+            LockArray* L = locks.load();
+            std::mutex* l0 = &L->locks0[hash0(L, x) % L->locks0.size()];
+            std::mutex* l1 = &L->locks1[hash1(L, x) % L->locks1.size()];
+            lock_counted(*l0);
+            lock_counted(*l1);
+            if (validate(L)) return Held{L, l0, l1};
+            l1->unlock();
+            l0->unlock();
+        }
+    }
+
+    void release(const Held& h) {
+        h.l0->unlock();
+        h.l1->unlock();
+    }
+
+    // Lock the single stripe guarding bucket hi of table i, as long as layout L is current
+    std::mutex* acquire_bucket(int i, int hi, LockArray* L) {
+        while (true) {
+            wait_for_owner();
+            if (locks.load() != L) return nullptr;
+            std::vector<std::mutex>& ls = (i == 0) ? L->locks0 : L->locks1;
+            std::mutex* l = &ls[hi % ls.size()];
+            lock_counted(*l);
+            if (validate(L)) return l;
+            l->unlock();
+        }
+    }
+
+    // Wait until every lock of L is free (Fig. 13.32). Threads that lock after the
+    // owner was marked back off in acquire(), so afterwards we have the table alone.
+    void quiesce(LockArray* L) {
+        for (auto& l : L->locks0) { while (!l.try_lock()) std::this_thread::yield(); l.unlock(); }
+        for (auto& l : L->locks1) { while (!l.try_lock()) std::this_thread::yield(); l.unlock(); }
+    }
+
+    bool take_ownership() {
+        std::thread::id none;
+        return owner.compare_exchange_strong(none, std::this_thread::get_id());
+    }
+
+    void drop_ownership() {
+        owner.store(std::thread::id());
+    }
+
+    // Double the lock arrays (up to one lock per bucket) without touching the table
+    void refine() {
+        if (!take_ownership()) return; // someone else is refining or resizing
+        LockArray* L = locks.load();
+        int n = L->locks0.size();
+        if (n < L->table_size && contention.load() >= CONTENTION_LIMIT) {
+            quiesce(L);
+            locks.store(new LockArray(std::min(2 * n, L->table_size), L->table_size, L->seed, L->seed1));
+            retired.emplace_back(L);
+            //std::cerr << "Refine " << n << " -> " << locks.load()->locks0.size() << " locks\n";
+        }
+        contention.store(0);
+        drop_ownership();
+    }
+
+    void maybe_refine() {
+        if (contention.load(std::memory_order_relaxed) >= CONTENTION_LIMIT) refine();
+    }
+
+    // Make room after add() failed. seen is the layout the caller found full; if it is no
+    // longer current someone else already changed the table and the caller just retries.
+    // A sparse table is reseeded in place (rehash_in_place()); otherwise buckets are split
+    // like in StripedCuckooHashSet::resize(): (h % 2n) is (h % n) or (h % n) + n, so seeds
+    // stay and every element moves at most once, by splice.
+    void resize(LockArray* seen) {
+        std::vector<std::list<T>> fresh0 = take_array(2 * seen->table_size);
+        std::vector<std::list<T>> fresh1 = take_array(2 * seen->table_size);
+        if (!take_ownership() || locks.load() != seen) {
+            if (owner.load() == std::this_thread::get_id()) drop_ownership();
+            recycle_array(std::move(fresh0));
+            recycle_array(std::move(fresh1));
+            return;
+        }
+        LockArray* L = seen;
+        quiesce(L);
+
+        LockArray* fresh = new LockArray(L->locks0.size(), L->table_size, L->seed, L->seed1);
+        std::list<T> leftovers;
+        bool grow = true;
+        if (rehash_budget > 0 && size() < REHASH_LOAD * 2 * L->table_size * PROBE_SIZE) {
+            rehash_budget--;
+            grow = !rehash_in_place(fresh, leftovers);
+        }
+        if (grow) {
+            std::cerr << "Resize\n";
+            do {
+                split_grow(fresh, fresh0, fresh1);
+                distribute(fresh, leftovers, PROBE_SIZE);
+            } while (!leftovers.empty());
+            rehash_budget = MAX_REHASHES;
+        }
+
+        locks.store(fresh);
+        retired.emplace_back(L);
+        drop_ownership();
+        recycle_array(std::move(fresh0));
+        recycle_array(std::move(fresh1));
+    }
+
+    // Split into the prepared arrays, which afterwards hold the old (empty) ones
+    void split_grow(LockArray* L, std::vector<std::list<T>>& fresh0, std::vector<std::list<T>>& fresh1) {
+        int old_size = L->table_size;
+        L->table_size *= 2;
+        if ((int)fresh0.size() != L->table_size) fresh0 = take_array(L->table_size);
+        if ((int)fresh1.size() != L->table_size) fresh1 = take_array(L->table_size);
+        for (int b = 0; b < old_size; b++) {
+            fresh0[b] = std::move(table0[b]);
+            fresh1[b] = std::move(table1[b]);
+            split_bucket(L, fresh0, b, old_size, 0);
+            split_bucket(L, fresh1, b, old_size, 1);
+        }
+        table0.swap(fresh0);
+        table1.swap(fresh1);
+    }
+
+    // Same pool as StripedCuckooHashSet::take_array() / recycle_array()
+    std::vector<std::list<T>> take_array(int size) {
+        {
+            std::lock_guard<std::mutex> guard(spare_mutex);
+            for (size_t k = 0; k < spare_tables.size(); k++) {
+                if ((int)spare_tables[k].capacity() >= size) {
+                    std::vector<std::list<T>> v = std::move(spare_tables[k]);
+                    spare_tables.erase(spare_tables.begin() + k);
+                    v.resize(size);
+                    return v;
+                }
+            }
+        }
+        return std::vector<std::list<T>>(size);
+    }
+
+    void recycle_array(std::vector<std::list<T>>&& v) {
+        if (v.capacity() == 0) return;
+        v.clear();
+        std::lock_guard<std::mutex> guard(spare_mutex);
+        if (spare_tables.size() < MAX_SPARE_TABLES) spare_tables.push_back(std::move(v));
+    }
+
+    // Splice pending nodes into a bucket holding fewer than limit elements; the rest stay
+    void distribute(const LockArray* L, std::list<T>& pending, int limit) {
+        for (auto it = pending.begin(); it != pending.end();) {
+            auto next = std::next(it);
+            std::list<T>& set0 = table0[hash0(L, *it)];
+            std::list<T>& set1 = table1[hash1(L, *it)];
+            if ((int)set0.size() < limit) set0.splice(set0.end(), pending, it);
+            else if ((int)set1.size() < limit) set1.splice(set1.end(), pending, it);
+            it = next;
+        }
+    }
+
+    // Same as StripedCuckooHashSet::rehash_in_place(): new seeds for the unpublished layout
+    // L, every node spliced out and back into its new buckets, a few seed pairs tried
+    bool rehash_in_place(LockArray* L, std::list<T>& leftovers) {
+        std::cerr << "Rehash\n";
+        std::uniform_int_distribution<size_t> dist;
+        for (int attempt = 0; attempt < 3; attempt++) {
+            for (auto& b : table0) leftovers.splice(leftovers.end(), b);
+            for (auto& b : table1) leftovers.splice(leftovers.end(), b);
+            L->seed = dist(rng);
+            L->seed1 = dist(rng);
+            distribute(L, leftovers, THRESHOLD);
+            distribute(L, leftovers, PROBE_SIZE);
+            if (leftovers.empty()) return true;
+        }
+        return false;
+    }
+
+    void split_bucket(const LockArray* L, std::vector<std::list<T>>& table, int b, int old_size, int table_index) {
+        std::list<T>& from = table[b];
+        std::list<T>& to = table[b + old_size];
+        for (auto it = from.begin(); it != from.end();) {
+            auto next = std::next(it);
+            if ((table_index == 0 ? hash0(L, *it) : hash1(L, *it)) != b) to.splice(to.end(), from, it);
+            it = next;
+        }
+    }
+
+    // Unlocked insert for populate(), no relocation
+    bool add_internal(const LockArray* L, const T& x) {
+        std::list<T>& set0 = table0[hash0(L, x)];
+        std::list<T>& set1 = table1[hash1(L, x)];
+        if ((int)set0.size() < THRESHOLD) {
+            set0.push_back(x);
+        } else if ((int)set1.size() < THRESHOLD) {
+            set1.push_back(x);
+        } else if ((int)set0.size() < PROBE_SIZE) {
+            set0.push_back(x);
+        } else if ((int)set1.size() < PROBE_SIZE) {
+            set1.push_back(x);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool present(const LockArray* L, const T& x) const {
+        for (auto& y : table0[hash0(L, x)]) if (y == x) return true;
+        for (auto& y : table1[hash1(L, x)]) if (y == x) return true;
+        return false;
+    }
+
+    // A refine() swaps in more locks over the same buckets. If that is all that separates
+    // L from now, move L to now and return true; false means resize() moved the elements
+    // (new size or seeds) and bucket indices computed under L are stale.
+    bool follow_refine(LockArray*& L, LockArray* now) {
+        if (now->table_size != L->table_size || now->seed != L->seed || now->seed1 != L->seed1) return false;
+        L = now;
+        return true;
+    }
+
+    // Relocation as in StripedCuckooHashSet (Fig. 13.27). The oldest element is read under
+    // its bucket's stripe. If the lock array was only refined the bucket is still crowded,
+    // so we carry on with the new array; if the table was resized or reseeded every element
+    // was redistributed and there is nothing left to relocate. L is updated for the caller.
+    bool relocate(int i, int hi, LockArray*& L) {
+        int j = 1 - i;
+        for (int round = 0; round < LIMIT; round++) {
+            std::mutex* l = acquire_bucket(i, hi, L);
+            if (!l) {
+                if (!follow_refine(L, locks.load())) return true;
+                round--;
+                continue;
+            }
+            std::list<T>& iSet = (i == 0 ? table0 : table1)[hi];
+            if ((int)iSet.size() < THRESHOLD) { l->unlock(); return true; }
+            T y = iSet.front();
+            l->unlock();
+
+            Held h = acquire(y);
+            if (h.L != L && !follow_refine(L, h.L)) { release(h); return true; }
+            int hj = (i == 0) ? hash1(L, y) : hash0(L, y);
+            std::list<T>& jSet = (j == 0 ? table0 : table1)[hj];
+            auto it = std::find(iSet.begin(), iSet.end(), y);
+            if (it != iSet.end()) {
+                iSet.erase(it);
+                if ((int)jSet.size() < THRESHOLD) {
+                    jSet.push_back(y);
+                    release(h);
+                    return true;
+                } else if ((int)jSet.size() < PROBE_SIZE) {
+                    jSet.push_back(y);
+                    i = 1 - i; hi = hj; j = 1 - j;
+                } else {
+                    iSet.push_back(y);
+                    release(h);
+                    return false;
+                }
+            } else if ((int)iSet.size() < THRESHOLD) { // another thread removed y
+                release(h);
+                return true;
+            }
+            release(h);
+        }
+        return false;
+    }
+
+public:
+    RefinableCuckooHashSet(int size, int limit, int probe_size, int threshold, int initial_locks, int contention_limit)
+        : LIMIT(limit),
+          PROBE_SIZE(probe_size),
+          THRESHOLD(threshold),
+          CONTENTION_LIMIT(contention_limit),
+          table0(size),
+          table1(size),
+          rng(std::mt19937(std::random_device{}())) {
+        std::uniform_int_distribution<size_t> dist;
+        size_t s0 = dist(rng), s1 = dist(rng);
+        locks.store(new LockArray(std::max(1, std::min(initial_locks, size)), size, s0, s1));
+    }
+
+    ~RefinableCuckooHashSet() {
+        delete locks.load();
+    }
+
+    bool contains(const T& x) {
+        Held h = acquire(x);
+        bool res = present(h.L, x);
+        release(h);
+        maybe_refine();
+        return res;
+    }
+
+    bool add(const T& x) {
+        while (true) {
+            Held h = acquire(x);
+            LockArray* L = h.L;
+            if (present(L, x)) { release(h); return false; }
+            int h0 = hash0(L, x);
+            int h1 = hash1(L, x);
+            std::list<T>& set0 = table0[h0];
+            std::list<T>& set1 = table1[h1];
+            int i = -1, hi = -1;
+            if ((int)set0.size() < THRESHOLD) {
+                set0.push_back(x);
+            } else if ((int)set1.size() < THRESHOLD) {
+                set1.push_back(x);
+            } else if ((int)set0.size() < PROBE_SIZE) {
+                set0.push_back(x); i = 0; hi = h0;
+            } else if ((int)set1.size() < PROBE_SIZE) {
+                set1.push_back(x); i = 1; hi = h1;
+            } else {
+                release(h);
+                resize(L);
+                continue; // retry against the new layout
+            }
+            release(h);
+            if (i != -1 && !relocate(i, hi, L)) resize(L); // x is in, the table is just crowded
+            maybe_refine();
+            return true;
+        }
+    }
+
+    bool remove(const T& x) {
+        Held h = acquire(x);
+        bool res = false;
+        std::list<T>& set0 = table0[hash0(h.L, x)];
+        auto it0 = std::find(set0.begin(), set0.end(), x);
+        if (it0 != set0.end()) {
+            set0.erase(it0);
+            res = true;
+        } else {
+            std::list<T>& set1 = table1[hash1(h.L, x)];
+            auto it1 = std::find(set1.begin(), set1.end(), x);
+            if (it1 != set1.end()) {
+                set1.erase(it1);
+                res = true;
+            }
+        }
+        release(h);
+        maybe_refine();
+        return res;
+    }
+
+    int size() {
+        int count = 0;
+        for (auto& bucket : table0) count += bucket.size();
+        for (auto& bucket : table1) count += bucket.size();
+        return count;
+    }
+
+    int num_locks() {
+        return locks.load()->locks0.size();
+    }
+
+    void populate(int n) {
+        std::uniform_int_distribution<int> dist(0, n * 8);
+        for (int i = 0; i < n; ++i)
+            while (!add_internal(locks.load(), dist(rng))) {}
+    }
+};
+
+// =========================
+// Benchmark Driver (Same as Striped)
+// =========================
+int main() {
+    int initial_size = 1000000;
+    int limit = 100;
+    int num_threads = 16;       // try 1, 2, 4, 8, 16 etc.
+    int total_ops = 1000000;
+    double insert_ratio = 0.10;
+    double remove_ratio = 0.10;
+    double contains_ratio = 0.80;
+    int probe_size = 4;
+    int threshold = 2;
+    int initial_locks = 16;      // starts coarse, refined as contention shows up
+    int contention_limit = 64;   // contended acquisitions that trigger a refine
+
+    RefinableCuckooHashSet<int> set(initial_size, limit, probe_size, threshold, initial_locks, contention_limit);
+    set.populate(initial_size*0.5);
+
+    int ops_per_thread = total_ops / num_threads;
+    int final_computed_size = set.size();
+    std::vector<int> computed_size(num_threads, 0);
+
+    std::cout << "Starting concurrent benchmark...\n";
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(std::random_device{}());
+            std::uniform_real_distribution<double> op_dist(0.0, 1.0);
+            std::uniform_int_distribution<int> key_dist(0, initial_size * 4);
+
+            for (int i = 0; i < ops_per_thread; ++i) {
+                double op_choice = op_dist(rng);
+                int key = key_dist(rng);
+
+                if (op_choice < insert_ratio) {
+                    if (set.add(key))
+                        computed_size[t]++;
+                } else if (op_choice < insert_ratio + remove_ratio) {
+                    if (set.remove(key))
+                        computed_size[t]--;
+                } else {
+                    set.contains(key);
+                }
+            }
+        });
+    }
+
+    for (auto& th : threads) th.join();
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end_time - start_time;
+
+    for (int c : computed_size)
+        final_computed_size += c;
+
+    std::cout << "Benchmark complete.\n";
+    std::cout << "Expected final size: " << final_computed_size << "\n";
+    std::cout << "Actual final size:   " << set.size() << "\n";
+    std::cout << "Final lock count:    " << set.num_locks() << " (started at " << initial_locks << ")\n";
+    std::cout << "Time taken:          " << duration.count() << " seconds\n";
+    return 0;
+}
+
+// g++ -std=c++17 -O2 -pthread refinableCuckooHash.cpp -o refinable_cuckoo_hash
+// ./refinable_cuckoo_hash
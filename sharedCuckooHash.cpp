@@ -0,0 +1,728 @@
+#include <vector>
+#include <functional>
+#include <random>
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <algorithm>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// g++ -std=c++17 -O2 -pthread sharedCuckooHash.cpp -o shared_cuckoo_hash -lrt
+
+// StripedCuckooHashSet whose buckets and stripe locks live in a POSIX shared memory
+// segment (shm_open + mmap), so several worker processes on one host use the same table
+// instead of each loading its own copy. The segment can be mapped at a different address
+// in every process: the header records where each region starts as an offset from the
+// segment base, and nothing inside the segment is a pointer. Locks are process-shared
+// robust pthread mutexes, the element count is a lock-free atomic.
+//
+// With SHARED_FILE the same layout is a MAP_SHARED mapping of a regular file, so the
+// table outlives every process and a restart maps it again instead of reloading it.
+// Slot updates are ordered so that a crash at any point leaves a file that recover()
+// repairs with one pass over the slot metadata (see Slot).
+//
+// The segment size is fixed when it is created, so there is no resize: add() returns
+// false when both buckets of a key stay full after one relocation (like static_cuckoo_set).
+// Keys are stored by value and must be trivially copyable, and every process must run
+// the same binary (std::hash is not guaranteed to agree between builds).
+enum SharedBacking { SHARED_MEMORY, SHARED_FILE };
+
+template <typename T>
+class SharedCuckooHashSet {
+    static_assert(std::is_trivially_copyable<T>::value, "keys are raw copies in shared memory");
+    static_assert(std::atomic<int64_t>::is_always_lock_free, "the element count must be address free");
+
+private:
+    static constexpr uint32_t MAGIC = 0x53434B43; // "CKCS"
+    static constexpr int MAX_LOCKS = 1024;
+    static constexpr size_t ALIGN = 64;
+
+    // Slot metadata word: bit 0 valid, bit 1 moving (copied here by relocate(), the source
+    // copy may not be cleared yet), the rest is the slot's version. A write takes the
+    // highest version in its bucket plus one, so the lowest valid version is the oldest key.
+    // A key is written before the metadata that makes it valid, and relocate() copies
+    // (MOVING), clears the source, then clears MOVING: after a crash every slot is either
+    // unused, a complete key, or a MOVING copy whose source recover() drops. In a table
+    // file the copy is also flushed to disk before the source is cleared (see move()).
+    static constexpr uint64_t VALID = 1;
+    static constexpr uint64_t MOVING = 2;
+    static constexpr int VERSION_SHIFT = 2;
+
+    // 16 byte aligned so (for small keys) a slot never straddles a page
+    struct alignas(16) Slot {
+        std::atomic<uint64_t> meta;
+        T key;
+    };
+
+    // Lives at offset 0 of the segment, written once by the creating process
+    struct Header {
+        uint32_t magic;
+        uint32_t key_size; // sizeof(T) of the creator, checked on attach
+        int32_t table_size;
+        int32_t LIMIT;
+        int32_t PROBE_SIZE;
+        int32_t THRESHOLD;
+        int32_t num_locks;
+        uint64_t seed, seed1;
+        uint64_t bytes;    // whole segment
+        // region offsets from the segment base
+        uint64_t locks0, locks1;
+        uint64_t slots0, slots1; // PROBE_SIZE slots per bucket
+        std::atomic<int64_t> num_elements; // recounted by recover()
+        std::atomic<uint32_t> ready;       // set last by the creator (or by recovery)
+        std::atomic<uint32_t> clean;       // SHARED_FILE: closed by its owner after a full msync
+    };
+
+    std::string name;
+    SharedBacking backing;
+    bool owner = false; // created or recovered the file, marks it clean on close
+    char* base = nullptr;
+    size_t bytes = 0;
+    Header* header = nullptr;
+
+    // Process local copies of the header fields and of the resolved region addresses
+    int LIMIT;
+    int table_size;
+    int PROBE_SIZE;
+    int THRESHOLD;
+    int num_locks;
+    size_t seed, seed1;
+    pthread_mutex_t* locks0;
+    pthread_mutex_t* locks1;
+    Slot* table0;
+    Slot* table1;
+    std::hash<T> hasher;
+    long page_size = ::sysconf(_SC_PAGESIZE);
+
+    static size_t align_up(size_t n) {
+        return (n + ALIGN - 1) & ~(ALIGN - 1);
+    }
+
+    template <typename U>
+    U* at(uint64_t offset) const {
+        return reinterpret_cast<U*>(base + offset);
+    }
+
+    int open_backing(int flags) {
+        int fd = backing == SHARED_FILE ? ::open(name.c_str(), flags, 0644)
+                                        : ::shm_open(name.c_str(), flags, 0600);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + name);
+        return fd;
+    }
+
+    void map_segment(int fd, size_t len) {
+        void* p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "mmap " + name);
+        base = static_cast<char*>(p);
+        bytes = len;
+        header = at<Header>(0);
+    }
+
+    bool valid_header() const {
+        return header->magic == MAGIC && header->bytes == bytes && header->key_size == sizeof(T);
+    }
+
+    // Copy the geometry out of the header and turn offsets into addresses for this process
+    void resolve() {
+        LIMIT = header->LIMIT;
+        table_size = header->table_size;
+        PROBE_SIZE = header->PROBE_SIZE;
+        THRESHOLD = header->THRESHOLD;
+        num_locks = header->num_locks;
+        seed = header->seed;
+        seed1 = header->seed1;
+        locks0 = at<pthread_mutex_t>(header->locks0);
+        locks1 = at<pthread_mutex_t>(header->locks1);
+        table0 = at<Slot>(header->slots0);
+        table1 = at<Slot>(header->slots1);
+    }
+
+    // Size, truncate (zero filled: every slot starts unused) and map a new segment
+    void create(int fd, int size, int limit, int probe_size, int threshold) {
+        int locks = size < MAX_LOCKS ? size : MAX_LOCKS;
+        size_t off = align_up(sizeof(Header));
+        size_t locks0_off = off; off = align_up(off + locks * sizeof(pthread_mutex_t));
+        size_t locks1_off = off; off = align_up(off + locks * sizeof(pthread_mutex_t));
+        size_t slots0_off = off; off = align_up(off + (size_t)size * probe_size * sizeof(Slot));
+        size_t slots1_off = off; off = align_up(off + (size_t)size * probe_size * sizeof(Slot));
+        if (::ftruncate(fd, off) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "ftruncate " + name);
+        }
+        map_segment(fd, off);
+
+        std::mt19937_64 rng(std::random_device{}());
+        Header* h = new (base) Header{};
+        h->magic = MAGIC;
+        h->key_size = sizeof(T);
+        h->table_size = size;
+        h->LIMIT = limit;
+        h->PROBE_SIZE = probe_size;
+        h->THRESHOLD = threshold;
+        h->num_locks = locks;
+        h->seed = rng();
+        h->seed1 = rng();
+        h->bytes = off;
+        h->locks0 = locks0_off;
+        h->locks1 = locks1_off;
+        h->slots0 = slots0_off;
+        h->slots1 = slots1_off;
+        resolve();
+        init_locks();
+        h->ready.store(1, std::memory_order_release);
+    }
+
+    // Reopen an existing table file. Lock words in the file belong to processes that are
+    // gone, so they are initialized again; a file that was not closed cleanly is repaired.
+    void reopen(int fd, size_t len) {
+        map_segment(fd, len);
+        if (len < sizeof(Header) || !valid_header()) {
+            ::munmap(base, bytes);
+            throw std::runtime_error(name + " is not a table file of this key type");
+        }
+        header->ready.store(0, std::memory_order_relaxed);
+        resolve();
+        init_locks();
+        if (header->clean.load(std::memory_order_relaxed) != 1) recover();
+        header->ready.store(1, std::memory_order_release);
+    }
+
+    void init_locks() {
+        for (int k = 0; k < num_locks; k++) {
+            init_lock(&locks0[k]);
+            init_lock(&locks1[k]);
+        }
+    }
+
+    static void init_lock(pthread_mutex_t* m) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        int rc = pthread_mutex_init(m, &attr);
+        pthread_mutexattr_destroy(&attr);
+        if (rc != 0) throw std::system_error(rc, std::generic_category(), "pthread_mutex_init");
+    }
+
+    // A worker that dies holding a stripe must not wedge the others. Thanks to the slot
+    // write order (see Slot) the worst it leaves behind is a key in both of its buckets.
+    static void lock(pthread_mutex_t* m) {
+        int rc = pthread_mutex_lock(m);
+        if (rc == EOWNERDEAD) pthread_mutex_consistent(m);
+        else if (rc != 0) throw std::system_error(rc, std::generic_category(), "pthread_mutex_lock");
+    }
+
+    static void unlock(pthread_mutex_t* m) {
+        pthread_mutex_unlock(m);
+    }
+
+    int hash0(const T& x) const {
+        return (hasher(x) ^ seed) % table_size;
+    }
+
+    int hash1(const T& x) const {
+        return (hasher(x) ^ seed1) % table_size;
+    }
+
+    pthread_mutex_t* lock0(int h) const {
+        return &locks0[h % num_locks];
+    }
+
+    pthread_mutex_t* lock1(int h) const {
+        return &locks1[h % num_locks];
+    }
+
+    // The table never changes size, so a key's buckets (and stripes) are fixed
+    void acquire(const T& x) {
+        lock(lock0(hash0(x)));
+        lock(lock1(hash1(x)));
+    }
+
+    void release(const T& x) {
+        unlock(lock0(hash0(x)));
+        unlock(lock1(hash1(x)));
+    }
+
+    Slot* bucket(int i, int h) const {
+        return (i == 0 ? table0 : table1) + (size_t)h * PROBE_SIZE;
+    }
+
+    static bool used(const Slot& s) {
+        return s.meta.load(std::memory_order_relaxed) & VALID;
+    }
+
+    static uint64_t version(const Slot& s) {
+        return s.meta.load(std::memory_order_relaxed) >> VERSION_SHIFT;
+    }
+
+    int count(int i, int h) const {
+        const Slot* b = bucket(i, h);
+        int n = 0;
+        for (int k = 0; k < PROBE_SIZE; k++) n += used(b[k]);
+        return n;
+    }
+
+    int find(int i, int h, const T& x) const {
+        const Slot* b = bucket(i, h);
+        for (int k = 0; k < PROBE_SIZE; k++)
+            if (used(b[k]) && b[k].key == x) return k;
+        return -1;
+    }
+
+    // Slot of the oldest key, the bucket must not be empty
+    int oldest(int i, int h) const {
+        const Slot* b = bucket(i, h);
+        int best = -1;
+        for (int k = 0; k < PROBE_SIZE; k++)
+            if (used(b[k]) && (best < 0 || version(b[k]) < version(b[best]))) best = k;
+        return best;
+    }
+
+    // Store x in a free slot (the caller checked there is one), key before metadata
+    int push_back(int i, int h, const T& x, uint64_t flags = 0) {
+        Slot* b = bucket(i, h);
+        uint64_t v = 0;
+        int free_slot = -1;
+        for (int k = 0; k < PROBE_SIZE; k++) {
+            if (version(b[k]) > v) v = version(b[k]);
+            if (!used(b[k]) && free_slot < 0) free_slot = k;
+        }
+        b[free_slot].key = x;
+        b[free_slot].meta.store(((v + 1) << VERSION_SHIFT) | VALID | flags, std::memory_order_release);
+        return free_slot;
+    }
+
+    void erase(int i, int h, int k) {
+        Slot& s = bucket(i, h)[k];
+        s.meta.store(s.meta.load(std::memory_order_relaxed) & ~(VALID | MOVING), std::memory_order_release);
+    }
+
+    // msync the pages holding [p, p + len) of a table file
+    void flush(const void* p, size_t len) {
+        size_t first = (static_cast<const char*>(p) - base) / page_size * page_size;
+        size_t last = static_cast<const char*>(p) - base + len;
+        if (::msync(base + first, last - first, MS_SYNC) != 0)
+            throw std::system_error(errno, std::generic_category(), "msync " + name);
+        if (on_flush) on_flush(first, last - first);
+    }
+
+    // Move y from slot k of (i, hi) to (j, hj) in the crash safe order described at Slot.
+    // Writeback may store pages in any order, so in a table file the copy is put on disk
+    // before the source is cleared; otherwise an OS crash could keep only the cleared
+    // source and lose a key that an earlier sync() had made durable.
+    void move(int i, int hi, int k, int j, int hj, const T& y) {
+        int d = push_back(j, hj, y, MOVING);
+        if (backing == SHARED_FILE) flush(&bucket(j, hj)[d], sizeof(Slot));
+        erase(i, hi, k);
+        Slot& s = bucket(j, hj)[d];
+        s.meta.store(s.meta.load(std::memory_order_relaxed) & ~MOVING, std::memory_order_release);
+    }
+
+    bool present(const T& x) const {
+        return find(0, hash0(x), x) >= 0 || find(1, hash1(x), x) >= 0;
+    }
+
+    // One pass over the slots after a crash: finish interrupted moves (drop the source copy
+    // of every MOVING key), drop the second copy of a key whose MOVING bit was cleared on
+    // disk before its source was, then recount, since num_elements may have missed updates
+    void recover() {
+        for (int i = 0; i < 2; i++) {
+            for (int h = 0; h < table_size; h++) {
+                Slot* b = bucket(i, h);
+                for (int k = 0; k < PROBE_SIZE; k++) {
+                    uint64_t m = b[k].meta.load(std::memory_order_relaxed);
+                    if ((m & VALID) && (m & MOVING)) {
+                        int oi = 1 - i;
+                        int oh = (oi == 0) ? hash0(b[k].key) : hash1(b[k].key);
+                        int ok = find(oi, oh, b[k].key);
+                        if (ok >= 0) erase(oi, oh, ok);
+                        b[k].meta.store(m & ~MOVING, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        for (int h = 0; h < table_size; h++) {
+            Slot* b = bucket(0, h);
+            for (int k = 0; k < PROBE_SIZE; k++) {
+                if (!used(b[k])) continue;
+                int h1 = hash1(b[k].key);
+                int k1 = find(1, h1, b[k].key);
+                if (k1 >= 0) erase(1, h1, k1);
+            }
+        }
+        int64_t n = 0;
+        for (int i = 0; i < 2; i++)
+            for (int h = 0; h < table_size; h++) n += count(i, h);
+        header->num_elements.store(n, std::memory_order_relaxed);
+    }
+
+    // As in StripedCuckooHashSet::relocate(): move the oldest key of bucket (i, hi) to its
+    // other bucket until (i, hi) is below THRESHOLD. The oldest key is read under the
+    // stripe of (i, hi), which is one of that key's own two locks.
+    bool relocate(int i, int hi) {
+        int j = 1 - i;
+        for (int round = 0; round < LIMIT; round++) {
+            pthread_mutex_t* stripe = (i == 0 ? lock0(hi) : lock1(hi));
+            lock(stripe);
+            if (count(i, hi) < THRESHOLD) { unlock(stripe); return true; }
+            T y = bucket(i, hi)[oldest(i, hi)].key;
+            unlock(stripe);
+
+            acquire(y);
+            int hj = (j == 0) ? hash0(y) : hash1(y);
+            int k = find(i, hi, y);
+            if (k >= 0) {
+                if (count(j, hj) < THRESHOLD) {
+                    move(i, hi, k, j, hj, y);
+                    release(y);
+                    return true;
+                } else if (count(j, hj) < PROBE_SIZE) {
+                    move(i, hi, k, j, hj, y);
+                    release(y);
+                    i = 1 - i; hi = hj; j = 1 - j;
+                    continue;
+                } else { // jSet is full, y stays where it is
+                    release(y);
+                    return false;
+                }
+            } else if (count(i, hi) < THRESHOLD) { // another process removed y
+                release(y);
+                return true;
+            }
+            release(y);
+        }
+        return false; // Reached LIMIT rounds
+    }
+
+public:
+    // Called with (offset, length) after every msync of a table file, so a test can keep
+    // its own image of what has reached the disk
+    std::function<void(size_t, size_t)> on_flush;
+
+    // SHARED_MEMORY: create the segment `name` (e.g. "/cuckoo_ids"), fails if it exists.
+    // SHARED_FILE: open the table file `name`, creating it if missing. An existing file
+    // keeps its own geometry (the size arguments are ignored) and is recovered if its
+    // last owner did not close it. Open it before starting workers that attach to it.
+    SharedCuckooHashSet(const std::string& name, int size, int limit, int probe_size, int threshold,
+                        SharedBacking backing = SHARED_MEMORY)
+        : name(name), backing(backing), owner(true) {
+        if (size <= 0 || probe_size <= 0 || threshold <= 0 || threshold > probe_size)
+            throw std::invalid_argument("bad table geometry");
+        int fd = open_backing(O_RDWR | O_CREAT | (backing == SHARED_MEMORY ? O_EXCL : 0));
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat " + name);
+        }
+        if (st.st_size == 0) {
+            try {
+                create(fd, size, limit, probe_size, threshold);
+            } catch (...) {
+                if (backing == SHARED_MEMORY) ::shm_unlink(name.c_str());
+                throw;
+            }
+        } else {
+            reopen(fd, st.st_size);
+        }
+        if (backing == SHARED_FILE) { // from here on a crash must be detected on reopen
+            header->clean.store(0, std::memory_order_relaxed);
+            ::msync(base, sizeof(Header), MS_SYNC);
+        }
+    }
+
+    // Attach to a segment (or table file) created by another process. Create it before
+    // starting workers: one still being initialized is rejected rather than waited for.
+    explicit SharedCuckooHashSet(const std::string& name, SharedBacking backing = SHARED_MEMORY)
+        : name(name), backing(backing) {
+        int fd = open_backing(O_RDWR);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error(name + " is not an initialized table");
+        }
+        map_segment(fd, st.st_size);
+        if (header->ready.load(std::memory_order_acquire) != 1 || !valid_header()) {
+            ::munmap(base, bytes);
+            throw std::runtime_error(name + " is not an initialized table of this key type");
+        }
+        resolve();
+    }
+
+    // The owner of a table file flushes it and marks it clean, so the next open skips recover()
+    ~SharedCuckooHashSet() {
+        if (owner && backing == SHARED_FILE) {
+            ::msync(base, bytes, MS_SYNC);
+            header->clean.store(1, std::memory_order_relaxed);
+            ::msync(base, sizeof(Header), MS_SYNC);
+        }
+        ::munmap(base, bytes);
+    }
+
+    SharedCuckooHashSet(const SharedCuckooHashSet&) = delete;
+    SharedCuckooHashSet& operator=(const SharedCuckooHashSet&) = delete;
+
+    // Remove the name; processes that have it mapped keep working on their mapping
+    static void unlink(const std::string& name, SharedBacking backing = SHARED_MEMORY) {
+        if (backing == SHARED_FILE) ::unlink(name.c_str());
+        else ::shm_unlink(name.c_str());
+    }
+
+    // Write dirty pages of a table file to disk. Without it the file survives any process
+    // crash (the page cache has every update); with it, an OS crash keeps every key that
+    // was present at this point and not removed since. Later updates may or may not
+    // survive, and a removed key may come back.
+    void sync() {
+        flush(base, bytes);
+    }
+
+    bool contains(const T& x) {
+        acquire(x);
+        bool res = present(x);
+        release(x);
+        return res;
+    }
+
+    // Returns false if x is already present, or if both of its buckets are still full
+    // after one relocation (the segment cannot grow)
+    bool add(const T& x) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            int i = -1, h = -1; // bucket to relocate from
+            acquire(x);
+            if (present(x)) { release(x); return false; }
+            int h0 = hash0(x);
+            int h1 = hash1(x);
+            int c0 = count(0, h0);
+            int c1 = count(1, h1);
+            if (c0 < THRESHOLD) {
+                push_back(0, h0, x);
+            } else if (c1 < THRESHOLD) {
+                push_back(1, h1, x);
+            } else if (c0 < PROBE_SIZE) {
+                push_back(0, h0, x); i = 0; h = h0;
+            } else if (c1 < PROBE_SIZE) {
+                push_back(1, h1, x); i = 1; h = h1;
+            } else {
+                release(x);
+                relocate(0, h0); // try to make room once
+                continue;
+            }
+            header->num_elements.fetch_add(1, std::memory_order_relaxed);
+            release(x);
+            if (i != -1) relocate(i, h); // x is stored either way, relocation only rebalances
+            return true;
+        }
+        return false;
+    }
+
+    // Looks in both buckets: a worker that died mid relocation can leave x in each
+    bool remove(const T& x) {
+        acquire(x);
+        int h0 = hash0(x);
+        int h1 = hash1(x);
+        int k0 = find(0, h0, x);
+        int k1 = find(1, h1, x);
+        if (k0 >= 0) erase(0, h0, k0);
+        if (k1 >= 0) erase(1, h1, k1);
+        bool res = k0 >= 0 || k1 >= 0;
+        if (res) header->num_elements.fetch_sub(1, std::memory_order_relaxed);
+        release(x);
+        return res;
+    }
+
+    int size() const {
+        return (int)header->num_elements.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return 2 * (size_t)table_size * PROBE_SIZE;
+    }
+
+    size_t segment_bytes() const {
+        return bytes;
+    }
+
+    void populate(int n) {
+        std::mt19937 rng(std::random_device{}());
+        std::uniform_int_distribution<int> dist(0, n * 8);
+        for (int i = 0; i < n; ++i)
+            while (!add(dist(rng))) {}
+    }
+};
+
+// Simulated OS crashes for SHARED_FILE. SIGKILL never loses a page cache write, so this
+// keeps its own image of the disk instead: the file contents as of every msync (through
+// on_flush), plus, at a crash, a random half of the pages written since. Recovery of that
+// image must keep every key that was present at the last sync() and not removed since.
+int writeback_crash_test(const char* path) {
+    const int size = 4096, limit = 100, probe_size = 4, threshold = 2;
+    const char* crash_path = "shared_cuckoo_crash_image.tbl";
+    long page = ::sysconf(_SC_PAGESIZE);
+    SharedCuckooHashSet<int>::unlink(path, SHARED_FILE);
+    SharedCuckooHashSet<int> set(path, size, limit, probe_size, threshold, SHARED_FILE);
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) { perror("open"); return 1; }
+    std::vector<char> disk(set.segment_bytes());
+    set.on_flush = [&](size_t off, size_t len) {
+        if (::pread(fd, disk.data() + off, len, off) != (ssize_t)len) perror("pread");
+    };
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> key_dist(0, 40000);
+    std::vector<char> now(disk.size()), present(40001, 0), durable(40001, 0);
+    long images = 0, lost = 0, checked = 0;
+    for (int round = 0; round < 20; round++) {
+        while (std::count(present.begin(), present.end(), 1) < 12000) {
+            int k = key_dist(rng);
+            if (set.add(k)) present[k] = 1;
+        }
+        set.sync();
+        durable = present;
+        for (int op = 0; op < 3000; op++) { // churn: adds relocate durable keys
+            int k = key_dist(rng);
+            if (rng() % 2) {
+                if (set.add(k)) present[k] = 1;
+            } else if (set.remove(k)) {
+                present[k] = 0;
+                durable[k] = 0; // may come back after a crash, need not
+            }
+        }
+        if (::pread(fd, now.data(), now.size(), 0) != (ssize_t)now.size()) { perror("pread"); return 1; }
+        for (int c = 0; c < 10; c++, images++) {
+            std::vector<char> image(disk);
+            for (size_t p = 0; p < image.size(); p += page)
+                if (rng() % 2) std::copy(now.begin() + p, now.begin() + std::min(p + page, now.size()), image.begin() + p);
+            int out = ::open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (out < 0 || ::write(out, image.data(), image.size()) != (ssize_t)image.size()) { perror("write"); return 1; }
+            ::close(out);
+            SharedCuckooHashSet<int> recovered(crash_path, size, limit, probe_size, threshold, SHARED_FILE);
+            for (int k = 0; k <= 40000; k++) {
+                if (!durable[k]) continue;
+                checked++;
+                if (!recovered.contains(k)) lost++;
+            }
+        }
+    }
+    ::close(fd);
+    SharedCuckooHashSet<int>::unlink(crash_path, SHARED_FILE);
+    SharedCuckooHashSet<int>::unlink(path, SHARED_FILE);
+    std::cout << "Crash images:        " << images << ", durable keys checked: " << checked
+              << ", lost: " << lost << "\n";
+    return lost ? 1 : 0;
+}
+
+// =========================
+// Benchmark Driver: forked worker processes on one segment
+// =========================
+int main() {
+    const char* name = "/shared_cuckoo_bench";
+    int initial_size = 1000000; // buckets per table, fixed for the segment's lifetime
+    int limit = 100;
+    int num_workers = 8;        // processes, each attaches to the segment by name
+    int total_ops = 1000000;
+    double insert_ratio = 0.10;
+    double remove_ratio = 0.10;
+    double contains_ratio = 0.80;
+    int probe_size = 4;
+    int threshold = 2;
+    // SHARED_FILE keeps the table in this file across runs: the next run maps it again
+    // (recovering it if a process crashed) instead of populating a new one
+    SharedBacking backing = SHARED_MEMORY;
+    const char* file_path = "shared_cuckoo.tbl";
+    if (backing == SHARED_FILE) name = file_path;
+    bool crash_test = false; // simulated OS crashes on a small table file instead of the benchmark
+    if (crash_test) return writeback_crash_test("shared_cuckoo_crash.tbl");
+
+    if (backing == SHARED_MEMORY) SharedCuckooHashSet<int>::unlink(name); // left over from a killed run
+    auto open_start = std::chrono::high_resolution_clock::now();
+    SharedCuckooHashSet<int> set(name, initial_size, limit, probe_size, threshold, backing);
+    std::chrono::duration<double> open_time = std::chrono::high_resolution_clock::now() - open_start;
+    if (set.size() == 0) set.populate(initial_size * 0.5);
+
+    // Per worker size changes come back through an anonymous shared page
+    int ops_per_worker = total_ops / num_workers;
+    int final_computed_size = set.size();
+    void* shared = ::mmap(nullptr, num_workers * sizeof(int), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) { perror("mmap"); return 1; }
+    int* computed_size = static_cast<int*>(shared);
+
+    std::cout << "Segment size:        " << set.segment_bytes() << " bytes\n";
+    std::cout << "Open time:           " << open_time.count() << " seconds\n";
+    std::cout << "Starting multi-process benchmark...\n" << std::flush;
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    std::vector<pid_t> workers;
+    for (int w = 0; w < num_workers; ++w) {
+        pid_t pid = ::fork();
+        if (pid < 0) { perror("fork"); return 1; }
+        if (pid == 0) {
+            int status = 0;
+            try {
+                SharedCuckooHashSet<int> mine(name, backing); // its own mapping, at another address
+                std::mt19937 rng(std::random_device{}());
+                std::uniform_real_distribution<double> op_dist(0.0, 1.0);
+                std::uniform_int_distribution<int> key_dist(0, initial_size * 4);
+                for (int i = 0; i < ops_per_worker; ++i) {
+                    double op_choice = op_dist(rng);
+                    int key = key_dist(rng);
+                    if (op_choice < insert_ratio) {
+                        if (mine.add(key)) computed_size[w]++;
+                    } else if (op_choice < insert_ratio + remove_ratio) {
+                        if (mine.remove(key)) computed_size[w]--;
+                    } else {
+                        mine.contains(key);
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "worker " << w << ": " << e.what() << "\n";
+                status = 1;
+            }
+            ::_exit(status);
+        }
+        workers.push_back(pid);
+    }
+
+    bool failed = false;
+    for (pid_t pid : workers) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = true;
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end_time - start_time;
+
+    for (int w = 0; w < num_workers; ++w)
+        final_computed_size += computed_size[w];
+
+    std::cout << "Benchmark complete.\n";
+    std::cout << "Expected final size: " << final_computed_size << "\n";
+    std::cout << "Actual final size:   " << set.size() << "\n";
+    std::cout << "Time taken:          " << duration.count() << " seconds\n";
+    if (failed) std::cout << "A worker failed\n";
+
+    ::munmap(shared, num_workers * sizeof(int));
+    if (backing == SHARED_MEMORY) SharedCuckooHashSet<int>::unlink(name);
+    return failed ? 1 : 0;
+}
+
+// g++ -std=c++17 -O2 -pthread sharedCuckooHash.cpp -o shared_cuckoo_hash -lrt
+// ./shared_cuckoo_hash
@@ -0,0 +1,226 @@
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <initializer_list>
+#include <random>
+#include <iostream>
+#include <chrono>
+
+// g++ -std=c++17 -O2 staticCuckooHash.cpp -o static_cuckoo_hash
+
+// Fixed capacity cuckoo set where capacity, LIMIT, PROBE_SIZE and THRESHOLD are template
+// parameters. Storage is two std::arrays of buckets (no allocation), the index mask is a
+// compile time constant and the probe over a bucket is unrolled. Everything is constexpr,
+// so small lookup tables (keyword sets etc.) can be built entirely at compile time.
+
+// std::hash is not constexpr, so the static set brings its own hashers
+template <typename T, typename = void>
+struct static_hash;
+
+template <typename T>
+struct static_hash<T, std::enable_if_t<std::is_integral<T>::value>> {
+    constexpr uint64_t operator()(T x) const { // splitmix64 finalizer
+        uint64_t z = (uint64_t)x + 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+};
+
+template <>
+struct static_hash<std::string_view> {
+    constexpr uint64_t operator()(std::string_view s) const { // FNV-1a, then mixed
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (char c : s) {
+            h ^= (unsigned char)c;
+            h *= 0x100000001b3ull;
+        }
+        return static_hash<uint64_t>{}(h);
+    }
+};
+
+template <typename T, size_t Capacity, int LIMIT = 32, int PROBE_SIZE = 4, int THRESHOLD = 2,
+          typename Hash = static_hash<T>>
+class static_cuckoo_set {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity (buckets per table) must be a power of two");
+    static_assert(0 < THRESHOLD && THRESHOLD <= PROBE_SIZE, "need 0 < THRESHOLD <= PROBE_SIZE");
+
+private:
+    static constexpr uint64_t MASK = Capacity - 1;
+
+    struct Bucket {
+        std::array<T, PROBE_SIZE> items{}; // oldest element first, like the striped probe sets
+        int count = 0;
+    };
+
+    std::array<Bucket, Capacity> table0{};
+    std::array<Bucket, Capacity> table1{};
+    int num_elements = 0;
+
+    // Low and high halves of one 64 bit hash give the two bucket indices
+    static constexpr size_t hash0(const T& x) {
+        return Hash{}(x) & MASK;
+    }
+
+    static constexpr size_t hash1(const T& x) {
+        return (Hash{}(x) >> 32) & MASK;
+    }
+
+    constexpr Bucket& bucket(int table_index, size_t pos) {
+        return table_index == 0 ? table0[pos] : table1[pos];
+    }
+
+    // Probe unrolled over the PROBE_SIZE slots; slots past count are never compared
+    template <size_t... I>
+    static constexpr bool in_bucket(const Bucket& b, const T& x, std::index_sequence<I...>) {
+        return (((int)I < b.count && b.items[I] == x) || ...);
+    }
+
+    static constexpr bool in_bucket(const Bucket& b, const T& x) {
+        return in_bucket(b, x, std::make_index_sequence<PROBE_SIZE>{});
+    }
+
+    static constexpr void push_back(Bucket& b, const T& x) {
+        b.items[b.count++] = x;
+    }
+
+    static constexpr T pop_front(Bucket& b) {
+        T y = b.items[0];
+        for (int k = 1; k < b.count; k++) b.items[k - 1] = b.items[k];
+        b.count--;
+        return y;
+    }
+
+    static constexpr bool erase(Bucket& b, const T& x) {
+        for (int k = 0; k < b.count; k++) {
+            if (b.items[k] == x) {
+                for (int m = k + 1; m < b.count; m++) b.items[m - 1] = b.items[m];
+                b.count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Same relocation as StripedCuckooHashSet::relocate(), single threaded:
+    // move oldest elements to their other bucket until bucket (i, hi) is below THRESHOLD
+    constexpr bool relocate(int i, size_t hi) {
+        for (int round = 0; round < LIMIT; round++) {
+            Bucket& iSet = bucket(i, hi);
+            if (iSet.count < THRESHOLD) return true;
+            T y = pop_front(iSet);
+            int j = 1 - i;
+            size_t hj = (j == 0) ? hash0(y) : hash1(y);
+            Bucket& jSet = bucket(j, hj);
+            if (jSet.count < THRESHOLD) {
+                push_back(jSet, y);
+                return true;
+            } else if (jSet.count < PROBE_SIZE) {
+                push_back(jSet, y);
+                i = j;
+                hi = hj;
+            } else {
+                push_back(iSet, y);
+                return false;
+            }
+        }
+        return false;
+    }
+
+public:
+    constexpr static_cuckoo_set() = default;
+
+    constexpr static_cuckoo_set(std::initializer_list<T> keys) {
+        for (const T& k : keys) add(k);
+    }
+
+    constexpr bool contains(const T& x) const {
+        return in_bucket(table0[hash0(x)], x) | in_bucket(table1[hash1(x)], x);
+    }
+
+    // Returns false if x is already present or both of its buckets are full.
+    // There is no resize: capacity is part of the type.
+    constexpr bool add(const T& x) {
+        if (contains(x)) return false;
+        size_t h0 = hash0(x);
+        size_t h1 = hash1(x);
+        Bucket& set0 = table0[h0];
+        Bucket& set1 = table1[h1];
+        if (set0.count >= PROBE_SIZE && set1.count >= PROBE_SIZE) {
+            relocate(0, h0); // try to make room once
+            if (set0.count >= PROBE_SIZE) return false;
+        }
+        if (set0.count < THRESHOLD) {
+            push_back(set0, x);
+        } else if (set1.count < THRESHOLD) {
+            push_back(set1, x);
+        } else if (set0.count < PROBE_SIZE) {
+            push_back(set0, x);
+            relocate(0, h0); // x is stored either way, relocation only rebalances
+        } else {
+            push_back(set1, x);
+            relocate(1, h1);
+        }
+        num_elements++;
+        return true;
+    }
+
+    constexpr bool remove(const T& x) {
+        if (erase(table0[hash0(x)], x) || erase(table1[hash1(x)], x)) {
+            num_elements--;
+            return true;
+        }
+        return false;
+    }
+
+    constexpr int size() const {
+        return num_elements;
+    }
+
+    static constexpr size_t capacity() {
+        return 2 * Capacity * PROBE_SIZE;
+    }
+};
+
+// Built at compile time, checked with static_assert
+constexpr static_cuckoo_set<std::string_view, 8> http_methods{
+    "GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"};
+static_assert(http_methods.size() == 9, "every keyword must fit");
+static_assert(http_methods.contains("OPTIONS") && !http_methods.contains("FETCH"), "compile time lookup");
+
+int main() {
+    const size_t buckets = 1 << 14; // per table, 2 * 16384 * 4 slots
+    int total_ops = 10000000;
+    double fill = 0.5;              // fraction of slots populated
+
+    // big enough that it should not live on the stack
+    static static_cuckoo_set<int, buckets> set;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> key_dist(0, (int)set.capacity() * 4);
+    while (set.size() < (int)(set.capacity() * fill)) set.add(key_dist(rng));
+
+    std::vector<int> keys(1 << 16);
+    for (auto& k : keys) k = key_dist(rng);
+
+    std::cout << "Starting benchmark test(s)...\n";
+    auto start_time = std::chrono::high_resolution_clock::now();
+    long hits = 0;
+    for (int i = 0; i < total_ops; ++i)
+        hits += set.contains(keys[i & (keys.size() - 1)]);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end_time - start_time;
+
+    std::cout << "Benchmark test(s) complete.\n";
+    std::cout << "Elements:            " << set.size() << " / " << set.capacity() << " slots\n";
+    std::cout << "Hits:                " << hits << "\n";
+    std::cout << "Time taken:          " << duration.count() << " seconds\n";
+    std::cout << "Keyword set has OPTIONS: " << http_methods.contains("OPTIONS") << "\n";
+    return 0;
+}
+
+// g++ -std=c++17 -O2 staticCuckooHash.cpp -o static_cuckoo_hash
+// ./static_cuckoo_hash
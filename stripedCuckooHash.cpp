@@ -6,11 +6,448 @@
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 #include <list>
 #include <shared_mutex>
+#include <memory>
+#include <condition_variable>
+#include <system_error>
+#include <type_traits>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
 // g++ -std=c++17 -O2 -pthread stripedCuckooHash.cpp -o striped_cuckoo_hash
 
+// SipHash-1-3 (1 compression round, 3 finalization rounds) with a 128 bit key.
+// Used instead of std::hash ^ seed when the keys may be chosen by an adversary.
+static inline uint64_t rotl64(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);
+    v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);
+}
+
+static uint64_t siphash13(const void* data, size_t len, uint64_t k0, uint64_t k1) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+    uint64_t v3 = 0x7465646279746573ull ^ k1;
+    size_t full = len & ~(size_t)7;
+    for (size_t i = 0; i < full; i += 8) {
+        uint64_t m;
+        std::memcpy(&m, p + i, 8);
+        v3 ^= m;
+        sip_round(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t b = (uint64_t)len << 56;
+    for (size_t i = 0; i < (len & 7); i++) b |= (uint64_t)p[full + i] << (8 * i);
+    v3 ^= b;
+    sip_round(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Keyed hash of the key's bytes (integers, strings), or of std::hash for anything else.
+// Only the first two are flood-resistant: for other T the key sees std::hash's output,
+// so keys that collide under std::hash collide under every sip_key as well.
+template <typename T>
+uint64_t keyed_hash(const T& x, uint64_t k0, uint64_t k1) {
+    if constexpr (std::is_integral<T>::value) {
+        return siphash13(&x, sizeof(T), k0, k1);
+    } else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+        std::string_view v = x;
+        return siphash13(v.data(), v.size(), k0, k1);
+    } else {
+        size_t h = std::hash<T>{}(x);
+        return siphash13(&h, sizeof(h), k0, k1);
+    }
+}
+
+// Write-ahead log of add/remove operations with group commit.
+// append() only copies the record into an in-memory buffer; commit() waits until
+// that record is on disk. Whichever committer finds no flush in progress becomes
+// the leader and writes + fsyncs everything buffered so far, so threads that commit
+// at the same time share one fsync.
+// The file starts with the lsn of the record before its first one: records are numbered
+// across truncate() (and across restarts), so a snapshot can say which of them it covers.
+enum WalOp : uint8_t { WAL_ADD = 1, WAL_REMOVE = 2 };
+
+template <typename T>
+class WriteAheadLog {
+public:
+    static constexpr size_t RECORD_SIZE = 1 + sizeof(T); // op byte + key bytes
+
+    struct LogHeader {
+        uint64_t magic;
+        uint64_t base_lsn; // the records that follow are base_lsn + 1, base_lsn + 2, ...
+    };
+    static constexpr uint64_t LOG_MAGIC = 0x314C41574B43; // "CKWAL1"
+
+    // Opens (or creates) the log at path and continues its numbering. A torn record at
+    // the tail is cut off, so the next append starts on a record boundary.
+    explicit WriteAheadLog(const char* path) : path(path) {
+        static_assert(std::is_trivially_copyable<T>::value, "WAL records are raw copies of T");
+        fd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "open WAL");
+        off_t end = ::lseek(fd, 0, SEEK_END);
+        if (end == 0) {
+            LogHeader h{LOG_MAGIC, 0};
+            write_all(fd, reinterpret_cast<const char*>(&h), sizeof(h));
+            if (::fdatasync(fd) != 0) throw std::system_error(errno, std::generic_category(), "fsync WAL");
+            return;
+        }
+        LogHeader h;
+        if (end < (off_t)sizeof(h) || ::pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || h.magic != LOG_MAGIC) {
+            ::close(fd);
+            throw std::runtime_error(std::string(path) + " is not a WAL");
+        }
+        base_lsn = h.base_lsn;
+        uint64_t records = (end - sizeof(h)) / RECORD_SIZE;
+        if (::ftruncate(fd, sizeof(h) + records * RECORD_SIZE) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "truncate WAL");
+        }
+        next_lsn = durable_lsn = base_lsn + records;
+    }
+
+    ~WriteAheadLog() {
+        try {
+            commit(last_lsn());
+        } catch (const std::exception& e) { // a destructor must not throw
+            std::cerr << "WAL: final commit failed: " << e.what() << "\n";
+        }
+        ::close(fd);
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Buffer one record, returns its log sequence number (1-based)
+    uint64_t append(WalOp op, const T& x) {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        size_t off = buffer.size();
+        buffer.resize(off + RECORD_SIZE);
+        buffer[off] = (char)op;
+        std::memcpy(&buffer[off + 1], &x, sizeof(T));
+        return ++next_lsn;
+    }
+
+    // Block until every record up to lsn is durable. Throws std::system_error if a write
+    // or fsync failed; after that the log is broken (part of a batch may or may not be on
+    // disk) and every later commit() throws the same error.
+    void commit(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(log_mutex);
+        while (durable_lsn < lsn) {
+            if (failed_errno) throw std::system_error(failed_errno, std::generic_category(), "WAL failed");
+            if (flushing) { // someone else is the leader, their fsync may cover us
+                flushed.wait(lock);
+                continue;
+            }
+            flushing = true;
+            std::vector<char> batch;
+            batch.swap(buffer);
+            uint64_t upto = next_lsn;
+            lock.unlock();
+
+            int err = 0;
+            try {
+                write_all(fd, batch.data(), batch.size());
+                if (::fdatasync(fd) != 0) err = errno;
+            } catch (const std::system_error& e) {
+                err = e.code().value();
+            }
+
+            lock.lock();
+            flushing = false;
+            if (err) failed_errno = err; // waiters wake up and throw too
+            else durable_lsn = upto;
+            flushed.notify_all();
+        }
+    }
+
+    // Last lsn handed out by append()
+    uint64_t last_lsn() {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        return next_lsn;
+    }
+
+    // Drop the records up to lsn upto, which a durable snapshot now covers. Everything
+    // buffered is written first, then the records after upto are copied to a new file
+    // that is renamed over the log. Appends carry on meanwhile, commits wait for it.
+    // Throws std::system_error like commit(), and the log is broken after a failure.
+    void truncate(uint64_t upto) {
+        std::unique_lock<std::mutex> lock(log_mutex);
+        flushed.wait(lock, [this] { return !flushing; });
+        if (failed_errno) throw std::system_error(failed_errno, std::generic_category(), "WAL failed");
+        flushing = true; // no leader writes to fd while it is being replaced
+        std::vector<char> batch;
+        batch.swap(buffer);
+        uint64_t last = next_lsn;
+        lock.unlock();
+
+        int err = 0;
+        try {
+            write_all(fd, batch.data(), batch.size());
+            uint64_t keep_from = std::max(upto, base_lsn);
+            std::vector<char> tail((last - keep_from) * RECORD_SIZE + sizeof(LogHeader));
+            LogHeader h{LOG_MAGIC, keep_from};
+            std::memcpy(tail.data(), &h, sizeof(h));
+            off_t from = sizeof(LogHeader) + (keep_from - base_lsn) * RECORD_SIZE;
+            for (size_t done = sizeof(h); done < tail.size();) {
+                ssize_t r = ::pread(fd, tail.data() + done, tail.size() - done, from + done - sizeof(h));
+                if (r <= 0) throw std::system_error(r < 0 ? errno : EIO, std::generic_category(), "read WAL");
+                done += r;
+            }
+            std::string tmp = path + ".tmp";
+            int out = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if (out < 0) throw std::system_error(errno, std::generic_category(), "open WAL");
+            try {
+                write_all(out, tail.data(), tail.size());
+                if (::fdatasync(out) != 0 || ::rename(tmp.c_str(), path.c_str()) != 0)
+                    throw std::system_error(errno, std::generic_category(), "replace WAL");
+            } catch (...) {
+                ::close(out);
+                throw;
+            }
+            sync_dir(path);
+            ::close(fd);
+            fd = out;
+            base_lsn = keep_from;
+        } catch (const std::system_error& e) {
+            err = e.code().value();
+        }
+
+        lock.lock();
+        flushing = false;
+        if (err) failed_errno = err;
+        else durable_lsn = last;
+        flushed.notify_all();
+        if (err) throw std::system_error(err, std::generic_category(), "truncate WAL");
+    }
+
+    // Feed every complete record in the log at path with an lsn above after to fn(op, x),
+    // in log order. A torn record at the tail (crash mid write) is ignored. Throws
+    // std::runtime_error if the log was truncated past after, since records are missing.
+    template <typename F>
+    static void replay(const char* path, F fn, uint64_t after = 0) {
+        int in = ::open(path, O_RDONLY);
+        if (in < 0) return; // no log yet
+        std::vector<char> data;
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = ::read(in, chunk, sizeof(chunk))) > 0) data.insert(data.end(), chunk, chunk + n);
+        ::close(in);
+        if (data.empty()) return;
+        LogHeader h;
+        if (data.size() < sizeof(h)) throw std::runtime_error(std::string(path) + " is not a WAL");
+        std::memcpy(&h, data.data(), sizeof(h));
+        if (h.magic != LOG_MAGIC) throw std::runtime_error(std::string(path) + " is not a WAL");
+        if (h.base_lsn > after)
+            throw std::runtime_error(std::string(path) + " starts after lsn " + std::to_string(h.base_lsn) +
+                                     ", the snapshot only covers up to " + std::to_string(after));
+        uint64_t lsn = h.base_lsn;
+        for (size_t off = sizeof(h); off + RECORD_SIZE <= data.size(); off += RECORD_SIZE) {
+            if (++lsn <= after) continue;
+            T x;
+            std::memcpy(&x, &data[off + 1], sizeof(T));
+            fn((WalOp)data[off], x);
+        }
+    }
+
+    // fsync the directory holding path, so a rename in it is durable
+    static void sync_dir(const std::string& path) {
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int d = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (d < 0) throw std::system_error(errno, std::generic_category(), "open " + dir);
+        int rc = ::fsync(d);
+        int err = errno;
+        ::close(d);
+        if (rc != 0) throw std::system_error(err, std::generic_category(), "fsync " + dir);
+    }
+
+private:
+    std::string path;
+    int fd;
+    std::mutex log_mutex;
+    std::condition_variable flushed;
+    std::vector<char> buffer; // appended but not yet written
+    uint64_t next_lsn = 0;    // last lsn handed out
+    uint64_t durable_lsn = 0; // last lsn that has been fsynced
+    uint64_t base_lsn = 0;    // lsn before the first record in the file
+    bool flushing = false;
+    int failed_errno = 0;     // set by the first failed write or fsync
+
+    static void write_all(int fd, const char* p, size_t len) {
+        while (len > 0) {
+            ssize_t w = ::write(fd, p, len);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "write WAL");
+            }
+            p += w;
+            len -= w;
+        }
+    }
+};
+
+// Read-only cuckoo set built offline from a fixed key set (see StripedCuckooHashSet::freeze()).
+// One flat array of SLOTS-wide buckets, every key lives in one of its two candidate
+// buckets. Placement is a maximum bipartite b-matching found with BFS augmenting paths,
+// so a build only fails if no assignment exists at all; with 4 slots per bucket that
+// allows ~97% load instead of the ~50% the mutable tables run at. Builds aim a little
+// below that (95%) since every failed attempt is a whole new placement. No locks.
+template <typename T, int SLOTS = 4>
+class FrozenCuckooHashSet {
+private:
+    size_t num_buckets = 1;
+    size_t seed = 0, seed1 = 0;
+    std::vector<T> slots;        // bucket b is slots[b*SLOTS, b*SLOTS + counts[b])
+    std::vector<uint8_t> counts;
+    size_t num_elements = 0;
+    std::hash<T> hasher;
+
+    static size_t mix(size_t z) { // splitmix64 finalizer, std::hash<int> is the identity
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    size_t hash0(const T& x) const {
+        return mix(hasher(x) ^ seed) % num_buckets;
+    }
+
+    size_t hash1(const T& x) const {
+        return mix(hasher(x) ^ seed1) % num_buckets;
+    }
+
+    bool in_bucket(size_t b, const T& x) const {
+        const T* p = &slots[b * SLOTS];
+        for (int k = 0; k < counts[b]; k++) if (p[k] == x) return true;
+        return false;
+    }
+
+    // Assign every key to one of its buckets, or return false if the graph has no
+    // complete assignment. owner[] holds key indices per slot while building.
+    bool place(const std::vector<T>& keys) {
+        std::vector<uint32_t> owner(num_buckets * SLOTS);
+        std::vector<uint32_t> h0(keys.size()), h1(keys.size());
+        counts.assign(num_buckets, 0);
+        for (size_t k = 0; k < keys.size(); k++) {
+            h0[k] = hash0(keys[k]);
+            h1[k] = hash1(keys[k]);
+        }
+        // BFS state, reused across keys; a bucket is visited if stamp[b] == current key + 1
+        std::vector<uint32_t> stamp(num_buckets, 0);
+        std::vector<uint32_t> parent(num_buckets); // slot index in the bucket we came from
+        std::vector<uint32_t> queue;
+
+        for (uint32_t k = 0; k < keys.size(); k++) {
+            uint32_t target = UINT32_MAX;
+            queue.clear();
+            for (uint32_t b : {h0[k], h1[k]}) {
+                if (stamp[b] == k + 1) continue;
+                stamp[b] = k + 1;
+                parent[b] = UINT32_MAX; // root
+                queue.push_back(b);
+            }
+            // each key in a full bucket can move to its other bucket
+            for (size_t q = 0; q < queue.size() && target == UINT32_MAX; q++) {
+                uint32_t b = queue[q];
+                if (counts[b] < SLOTS) { target = b; break; }
+                for (int i = 0; i < SLOTS; i++) {
+                    uint32_t y = owner[b * SLOTS + i];
+                    uint32_t alt = (h0[y] == b) ? h1[y] : h0[y];
+                    if (stamp[alt] == k + 1) continue;
+                    stamp[alt] = k + 1;
+                    parent[alt] = b * SLOTS + i;
+                    queue.push_back(alt);
+                }
+            }
+            if (target == UINT32_MAX) return false;
+
+            // shift keys along the augmenting path, ending with k in a root bucket
+            uint32_t b = target;
+            uint32_t free_slot = b * SLOTS + counts[b]++;
+            while (parent[b] != UINT32_MAX) {
+                uint32_t from = parent[b];
+                owner[free_slot] = owner[from];
+                free_slot = from;
+                b = from / SLOTS;
+            }
+            owner[free_slot] = k;
+        }
+
+        slots.assign(num_buckets * SLOTS, T{});
+        for (size_t b = 0; b < num_buckets; b++)
+            for (int i = 0; i < counts[b]; i++)
+                slots[b * SLOTS + i] = keys[owner[b * SLOTS + i]];
+        return true;
+    }
+
+public:
+    FrozenCuckooHashSet() = default;
+
+    // Each failed placement gets new seeds and 3% more buckets, so after MAX_ATTEMPTS
+    // the load is under half the target and only repeated keys can still fail
+    static constexpr int MAX_ATTEMPTS = 30;
+
+    // keys must be distinct. load is the target fraction of occupied slots, in (0, 1].
+    // Throws std::invalid_argument for a bad load and std::runtime_error if no placement
+    // is found within MAX_ATTEMPTS (duplicate keys, or a hash that maps them together).
+    explicit FrozenCuckooHashSet(const std::vector<T>& keys, double load = 0.95) : num_elements(keys.size()) {
+        if (!(load > 0 && load <= 1)) throw std::invalid_argument("FrozenCuckooHashSet: load must be in (0, 1]");
+        std::mt19937_64 rng(std::random_device{}());
+        num_buckets = std::max<size_t>(1, (size_t)(keys.size() / (SLOTS * load)) + 1);
+        for (int attempt = 0;; attempt++) {
+            seed = rng();
+            seed1 = rng();
+            if (place(keys)) break;
+            if (attempt + 1 == MAX_ATTEMPTS)
+                throw std::runtime_error("FrozenCuckooHashSet: no placement for " + std::to_string(keys.size()) +
+                                         " keys after " + std::to_string(MAX_ATTEMPTS) + " attempts, are they distinct?");
+            num_buckets += num_buckets * 3 / 100 + 1; // unlucky seeds or load too high
+        }
+    }
+
+    bool contains(const T& x) const {
+        return in_bucket(hash0(x), x) || in_bucket(hash1(x), x);
+    }
+
+    size_t size() const {
+        return num_elements;
+    }
+
+    double load_factor() const {
+        return (double)num_elements / (num_buckets * SLOTS);
+    }
+
+    size_t memory_bytes() const {
+        return slots.size() * sizeof(T) + counts.size();
+    }
+};
+
 template <typename T>
 class StripedCuckooHashSet {
 private:
@@ -18,84 +455,507 @@ private:
     int table_size;       // Number of buckets per table
     int PROBE_SIZE;       // Max elements per bucket
     int THRESHOLD;        // Threshold of when to relocate
+
+    // When add() runs out of room below this load (elements / slots) the seeds are blamed
+    // and the table is reseeded in place instead of doubled (see rehash_in_place())
+    static constexpr double REHASH_LOAD = 0.4;
+    static constexpr int MAX_REHASHES = 4; // reseeds allowed per table size
+    int rehash_budget = MAX_REHASHES;
+
+    // Hash flooding defense, as in CuckooHashSet: repeated sparse failures at one table
+    // size switch hash0/hash1 from std::hash ^ seed to SipHash keyed by (seed, sip_key)
+    static constexpr int FLOOD_FAILURES = 3;
+    int sparse_failures = 0;
+    bool keyed = false;
+    bool want_keyed = false; // set by use_keyed_hash(), applied by the next resize()
+    uint64_t sip_key = 0;    // never 0 while keyed (snapshots store 0 for unkeyed)
     //std::vector<std::vector<T>> table0;
     //std::vector<std::vector<T>> table1;
-    // Use std::list<T> for probe sets (as 'oldest' element removal is needed)
-    std::vector<std::list<T>> table0;
-    std::vector<std::list<T>> table1;
+    // Use std::list<T> for probe sets (as 'oldest' element removal is needed). Every
+    // probe set carries its own lock word, so there are no separate lock arrays: locking,
+    // the version check and the probe all start on the same cache line.
+    // header: bit 0 LOCKED, bit 1 RETIRED (the array was replaced by resize()), and a
+    // version above them that every unlock advances.
+    static constexpr uint64_t LOCKED = 1;
+    static constexpr uint64_t RETIRED = 2;
+    static constexpr uint64_t VERSION_ONE = 4;
+    struct alignas(32) ProbeSet : std::list<T> {
+        std::atomic<uint64_t> header{0};
+
+        ProbeSet() = default;
+        // moving the elements (split_grow) leaves both lock words where they are
+        ProbeSet(ProbeSet&& o) noexcept : std::list<T>(std::move(o)) {}
+        ProbeSet& operator=(ProbeSet&& o) noexcept {
+            std::list<T>::operator=(std::move(o));
+            return *this;
+        }
+    };
+    std::vector<ProbeSet> table0;
+    std::vector<ProbeSet> table1;
 
-    std::vector<std::mutex> locks0;
-    std::vector<std::mutex> locks1;
+    // What acquire() locks through: the arrays and their size as of the last resize().
+    // Threads may still be spinning on a replaced array, so resize() leaves its buckets
+    // locked and RETIRED and only recycles it after a grace period (see LockPhase).
+    std::atomic<ProbeSet*> live0{nullptr};
+    std::atomic<ProbeSet*> live1{nullptr};
+    std::atomic<int> live_size{0};
+    // Bumped by every resize() (grow or reseed) under global_resize_lock, see resize()
+    std::atomic<uint64_t> layout_changes{0};
+
+    // Grace periods for replaced arrays. Code that locks through live0/live1 runs as a
+    // LockPhase, counted in its thread's stripe under the parity of grace_epoch it began
+    // in. resize() publishes the new arrays, flips the parity and waits for the old one
+    // to drain: a lock phase that started later reads the new pointers, so nobody can
+    // still hold one into the old arrays and they go back to the pool at once.
+    static constexpr int GRACE_STRIPES = 64;
+    struct alignas(64) GraceCount {
+        std::atomic<int> active[2];
+    };
+    std::unique_ptr<GraceCount[]> grace{new GraceCount[GRACE_STRIPES]()};
+    std::atomic<uint64_t> grace_epoch{0};
+    static inline std::atomic<int> next_grace_stripe{0};
+
+    class LockPhase {
+        std::atomic<int>& active;
+        static int stripe() {
+            thread_local int s = next_grace_stripe.fetch_add(1) % GRACE_STRIPES;
+            return s;
+        }
+    public:
+        explicit LockPhase(StripedCuckooHashSet& set)
+            : active(set.grace[stripe()].active[set.grace_epoch.load() & 1]) {
+            active.fetch_add(1); // seq_cst: ordered before the live0/live1 loads that follow
+        }
+        ~LockPhase() { active.fetch_sub(1, std::memory_order_release); }
+        LockPhase(const LockPhase&) = delete;
+        LockPhase& operator=(const LockPhase&) = delete;
+    };
+
+    // After publish(): wait until every lock phase that may have read the old arrays is over
+    void wait_for_grace() {
+        int old = grace_epoch.fetch_add(1) & 1;
+        for (int k = 0; k < GRACE_STRIPES; k++)
+            while (grace[k].active[old].load() != 0) std::this_thread::yield();
+    }
+
+    // Held shared by for_each_chunked() walks, which index the arrays directly, and
+    // exclusively by resize() after the election, so a layout change waits for them
     std::shared_mutex resize_mutex;
 
-    //std::mutex global_resize_lock;
+    // Bucket arrays for resize() are built before the table is locked, so their page
+    // faults happen while other threads keep working. Arrays a resize did not use (or
+    // replaced) are kept here and handed out again if they are big enough.
+    static constexpr size_t MAX_SPARE_TABLES = 4;
+    std::mutex spare_mutex;
+    std::vector<std::vector<ProbeSet>> spare_tables;
+
+    std::mutex global_resize_lock; // one resize() or lock_all() at a time
 
     // Random seeds for hashing
     size_t seed, seed1;
     std::mt19937 rng;
     std::hash<T> hasher;
 
+    WriteAheadLog<T>* wal = nullptr; // optional durability, see attach_log()
+
+    // Optional negative lookup cache, see use_negative_cache(). Each thread remembers recent
+    // misses in a small direct-mapped array shared by all sets of type T (entries carry the
+    // set's instance_id). An entry holds the insert epoch of its key's epoch stripe as read
+    // before the probe, and every insert bumps that epoch, so a cached miss is dropped as
+    // soon as anything in the stripe is added. Stripes come from std::hash alone, without
+    // the seeds, so they stay put across resizes and reseeds.
+    static constexpr int EPOCH_STRIPES = 256;
+    static constexpr int NEG_CACHE_BITS = 10; // 1024 entries per thread
+    struct alignas(64) Epoch {
+        std::atomic<uint64_t> value{0};
+    };
+    struct NegEntry {
+        uint64_t owner = 0; // instance_id, 0 is never used
+        uint64_t epoch = 0;
+        T key{};
+    };
+    bool negative_cache = false;
+    std::unique_ptr<Epoch[]> epochs;
+    uint64_t instance_id;
+    static inline std::atomic<uint64_t> next_instance_id{1};
+
+    // Dirty tracking for delta snapshots: one bit per block of BLOCK_BUCKETS bucket
+    // indices (covering that range in both tables), set by every write
+    static constexpr int BLOCK_BUCKETS = 64;
+    std::vector<std::atomic<uint64_t>> dirty;
+    uint64_t snapshot_id = 0; // id of the last full snapshot, deltas are chained to it
+    uint64_t snapshot_lsn = 0; // WAL records up to this one are in the loaded snapshot
+    uint64_t delta_seq = 0;   // deltas written since that full snapshot
+    bool needs_full = true;   // no full snapshot yet, or a resize changed the layout
+
+    // On-disk header shared by full snapshots and deltas. version changes whenever the
+    // layout does (2 added sip_key, 3 lsn); files of another version are rejected, not misread.
+    struct SnapshotHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t table_size;
+        uint32_t reserved; // 0, keeps the 64-bit fields aligned without hidden padding
+        uint64_t seed, seed1;
+        uint64_t snapshot_id;
+        uint64_t seq; // full: last delta folded in (0 if none), delta: its position in the chain
+        uint64_t count; // full: buckets per table, delta: number of blocks
+        uint64_t sip_key; // 0 unless the keyed hash is in use
+        uint64_t lsn; // last WAL record reflected in the file, 0 without a log
+    };
+    static constexpr uint32_t FULL_MAGIC = 0x46434B43;  // "CKCF"
+    static constexpr uint32_t DELTA_MAGIC = 0x44434B43; // "CKCD"
+    static constexpr uint32_t SNAPSHOT_VERSION = 3;
+
+    // Decoded snapshot: table0 buckets followed by table1 buckets
+    struct SnapshotImage {
+        SnapshotHeader header;
+        std::vector<std::vector<T>> buckets;
+    };
+
     int hash0(const T& x) const { //good
-        return (hasher(x) ^ seed) % table_size;
+        return hash0(x, table_size);
     }
 
     int hash1(const T& x) const { //good
-        return (hasher(x) ^ seed1) % table_size;
+        return hash1(x, table_size);
+    }
+
+    // For n buckets per table; outside the locks only live_size is safe to use as n
+    int hash0(const T& x, int n) const {
+        if (keyed) return keyed_hash(x, seed, sip_key) % n;
+        return (hasher(x) ^ seed) % n;
+    }
+
+    int hash1(const T& x, int n) const {
+        if (keyed) return keyed_hash(x, seed1, sip_key) % n;
+        return (hasher(x) ^ seed1) % n;
+    }
+
+    static uint64_t mix(size_t h) {
+        return (uint64_t)h * 0x9e3779b97f4a7c15ull;
+    }
+
+    std::atomic<uint64_t>& epoch_of(size_t h) {
+        return epochs[(mix(h) >> 32) % EPOCH_STRIPES].value;
+    }
+
+    static NegEntry& neg_entry(size_t h) {
+        thread_local std::vector<NegEntry> cache(1 << NEG_CACHE_BITS);
+        return cache[mix(h) >> (64 - NEG_CACHE_BITS)];
+    }
+
+    // Called after x is stored (a bump before that could be read by a probe that still
+    // misses x, and the miss would then be cached under the new epoch)
+    void note_added(const T& x) {
+        if (negative_cache) epoch_of(hasher(x)).fetch_add(1);
+    }
+
+    // Probe under the locks, reading the epoch first: an add of x that the probe misses
+    // bumps it afterwards and so invalidates the entry written here
+    bool contains_cached(const T& x) {
+        size_t h = hasher(x);
+        uint64_t now = epoch_of(h).load();
+        NegEntry& e = neg_entry(h);
+        if (e.owner == instance_id && e.epoch == now && e.key == x) return false;
+        acquire(x);
+        bool res = present(x);
+        release(x);
+        if (!res) {
+            e.owner = instance_id;
+            e.epoch = now;
+            e.key = x;
+        }
+        return res;
     }
 
-    // Lock both buckets for an element (in order to avoid deadlock)
+    // Spin until b is ours. False if b belongs to an array resize() has replaced (it stays
+    // locked for good), the caller then starts over on the live arrays.
+    static bool lock_bucket(ProbeSet& b) {
+        for (int spins = 0;; spins++) {
+            uint64_t v = b.header.load(std::memory_order_acquire);
+            if (v & RETIRED) return false;
+            if (!(v & LOCKED) &&
+                b.header.compare_exchange_weak(v, v | LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+            if (spins >= 64) std::this_thread::yield(); // the holder may not be running
+        }
+    }
+
+    // Returns the header as left for the next holder
+    static uint64_t unlock_bucket(ProbeSet& b) {
+        uint64_t v = (b.header.load(std::memory_order_relaxed) & ~LOCKED) + VERSION_ONE;
+        b.header.store(v, std::memory_order_release);
+        return v;
+    }
+
+    // Lock bucket h0 of table0 and then h1 of table1 (the global lock order). Once a
+    // live table0 bucket is held no resize() can finish, so live1 is from the same array
+    // generation and never RETIRED.
+    void lock_pair(int h0, int h1) {
+        LockPhase phase(*this);
+        while (true) {
+            if (!lock_bucket(live0.load()[h0])) continue;
+            lock_bucket(live1.load()[h1]);
+            return;
+        }
+    }
+
+    void unlock_pair(int h0, int h1) {
+        unlock_bucket(table1[h1]);
+        unlock_bucket(table0[h0]);
+    }
+
+    // Lock both buckets for an element (in order to avoid deadlock). A resize or reseed
+    // between hashing and locking moves x, so the buckets are checked again once held.
+    // live_size is read before the arrays and published after them, so h0/h1 are always
+    // in range for the arrays locked.
     void acquire(const T& x) { //good
-        locks0[hash0(x)].lock();
-        locks1[hash1(x)].lock();
+        while (true) {
+            int n = live_size.load(std::memory_order_acquire);
+            int h0 = hash0(x, n);
+            int h1 = hash1(x, n);
+            lock_pair(h0, h1);
+            if (hash0(x) == h0 && hash1(x) == h1) return;
+            unlock_pair(h0, h1);
+        }
     }
 
     void release(const T& x) { //good
-        locks0[hash0(x)].unlock();
-        locks1[hash1(x)].unlock();
+        unlock_pair(hash0(x), hash1(x));
+    }
+
+    // The arrays and then their size, for acquire(). The pointers are seq_cst like the
+    // lock phase loads, so wait_for_grace() after this cannot miss a reader of the old ones.
+    void publish() {
+        live1.store(table1.data());
+        live0.store(table0.data());
+        live_size.store(table_size, std::memory_order_release);
+    }
+
+    // Lock bucket hi of table i on its own (nothing else held) and read its oldest
+    // element and the version it is left with. False if the bucket is below THRESHOLD.
+    bool peek_front(int i, int hi, T& y, uint64_t& version) {
+        LockPhase phase(*this);
+        while (true) {
+            ProbeSet& b = (i == 0 ? live0 : live1).load()[hi];
+            if (!lock_bucket(b)) continue;
+            bool over = (int)b.size() >= THRESHOLD;
+            if (over) y = b.front();
+            version = unlock_bucket(b);
+            return over;
+        }
+    }
+
+    static size_t dirty_words(int buckets) {
+        size_t blocks = (buckets + BLOCK_BUCKETS - 1) / BLOCK_BUCKETS;
+        return (blocks + 63) / 64;
+    }
+
+    void mark_dirty(int h) {
+        int block = h / BLOCK_BUCKETS;
+        dirty[block / 64].fetch_or(1ull << (block % 64), std::memory_order_relaxed);
+    }
+
+    // Snapshots stop writers the same way resize() does: every bucket, table0 first. The
+    // mutex keeps a second resize() from walking arrays the first one is replacing.
+    void lock_all() {
+        global_resize_lock.lock();
+        lock_buckets();
+    }
+
+    // The bucket half of lock_all(), for a caller already holding global_resize_lock
+    void lock_buckets() {
+        for (auto& b : table0) lock_bucket(b);
+        for (auto& b : table1) lock_bucket(b);
+    }
+
+    void unlock_all() {
+        for (auto& b : table1) unlock_bucket(b);
+        for (auto& b : table0) unlock_bucket(b);
+        global_resize_lock.unlock();
+    }
+
+    template <typename Bucket>
+    static void append_bucket(std::vector<char>& out, const Bucket& bucket) {
+        uint32_t n = bucket.size();
+        const char* p = reinterpret_cast<const char*>(&n);
+        out.insert(out.end(), p, p + sizeof(n));
+        for (const T& x : bucket) {
+            p = reinterpret_cast<const char*>(&x);
+            out.insert(out.end(), p, p + sizeof(T));
+        }
+    }
+
+    // Write to a temporary file, fsync it and rename it over path: a crash leaves either
+    // the old or the new file, and a returned save is on disk (the WAL may drop records then)
+    static void write_file(const std::string& path, const std::vector<char>& data) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            f.write(data.data(), data.size());
+            if (!f.flush()) throw std::runtime_error("cannot write snapshot " + path);
+        }
+        int fd = ::open(tmp.c_str(), O_RDONLY);
+        if (fd < 0 || ::fsync(fd) != 0 || ::rename(tmp.c_str(), path.c_str()) != 0) {
+            int err = errno;
+            if (fd >= 0) ::close(fd);
+            throw std::system_error(err, std::generic_category(), "cannot write snapshot " + path);
+        }
+        ::close(fd);
+        WriteAheadLog<T>::sync_dir(path);
+    }
+
+    // Minimal reader over a whole snapshot file
+    struct SnapshotReader {
+        std::vector<char> data;
+        size_t off = 0;
+
+        explicit SnapshotReader(const std::string& path) {
+            std::ifstream f(path, std::ios::binary);
+            if (!f) throw std::runtime_error("cannot open snapshot " + path);
+            data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        }
+
+        template <typename V>
+        V get() {
+            if (off + sizeof(V) > data.size()) throw std::runtime_error("truncated snapshot");
+            V v;
+            std::memcpy(&v, &data[off], sizeof(V));
+            off += sizeof(V);
+            return v;
+        }
+
+        void bucket(std::vector<T>& out) {
+            uint32_t n = get<uint32_t>();
+            out.clear();
+            for (uint32_t k = 0; k < n; k++) out.push_back(get<T>());
+        }
+    };
+
+    static void check_version(const std::string& path, const SnapshotHeader& h) {
+        if (h.version != SNAPSHOT_VERSION)
+            throw std::runtime_error(path + " has snapshot format " + std::to_string(h.version) +
+                                     ", expected " + std::to_string(SNAPSHOT_VERSION));
+    }
+
+    static void read_full(const std::string& path, SnapshotImage& img) {
+        SnapshotReader r(path);
+        img.header = r.template get<SnapshotHeader>();
+        if (img.header.magic != FULL_MAGIC) throw std::runtime_error(path + " is not a full snapshot");
+        check_version(path, img.header);
+        img.buckets.assign(2 * (size_t)img.header.table_size, {});
+        for (auto& b : img.buckets) r.bucket(b);
+    }
+
+    // Replace the blocks recorded in a delta; deltas must come in chain order
+    static void apply_delta(const std::string& path, SnapshotImage& img) {
+        SnapshotReader r(path);
+        SnapshotHeader h = r.template get<SnapshotHeader>();
+        if (h.magic == DELTA_MAGIC) check_version(path, h);
+        if (h.magic != DELTA_MAGIC || h.snapshot_id != img.header.snapshot_id ||
+            h.table_size != img.header.table_size || h.seq != img.header.seq + 1)
+            throw std::runtime_error(path + " does not continue this snapshot chain");
+        size_t n = img.header.table_size;
+        for (uint64_t k = 0; k < h.count; k++) {
+            size_t first = (size_t)r.template get<uint32_t>() * BLOCK_BUCKETS;
+            size_t last = std::min(first + BLOCK_BUCKETS, n);
+            for (size_t b = first; b < last; b++) r.bucket(img.buckets[b]);
+            for (size_t b = first; b < last; b++) r.bucket(img.buckets[n + b]);
+        }
+        img.header.seq = h.seq;
+        img.header.lsn = h.lsn;
+    }
+
+    static void write_full(const std::string& path, const SnapshotImage& img) {
+        std::vector<char> out(sizeof(SnapshotHeader));
+        std::memcpy(out.data(), &img.header, sizeof(SnapshotHeader));
+        for (auto& b : img.buckets) append_bucket(out, b);
+        write_file(path, out);
+    }
+
+    // Append to the WAL while x's locks are still held, so log order matches apply order per key
+    uint64_t log_op(WalOp op, const T& x) {
+        return wal ? wal->append(op, x) : 0;
+    }
+
+    // Wait for the record to be durable, called after the locks are released. A failed
+    // log throws here, with the change already visible in memory.
+    void sync_log(uint64_t lsn) {
+        if (lsn) wal->commit(lsn);
     }
 
 
     // Resize (double capacity)
     void resize() { // Good 
+        uint64_t seen = layout_changes.load(std::memory_order_acquire);
+        // Elect one resizer before anything is allocated: threads that ran out of room in
+        // the same layout queue on global_resize_lock, and all but the first find it
+        // changed and return without building arrays of their own
+        std::unique_lock<std::mutex> elected(global_resize_lock);
+        if (layout_changes.load(std::memory_order_relaxed) != seen && !(want_keyed && !keyed))
+            return; // already resized or reseeded, the caller retries against that
         int old_capacity = table_size;
-        //std::lock_guard<std::mutex> global_lock(global_resize_lock);
-        // Wait for all adds/deletes to finish and block new ones
-        //std::cout << "\n=== ===\n" << "resize called" << "\n-----------\n";
-        //std::unique_lock<std::shared_mutex> resize_guard(resize_mutex);
-        // std::cout << "\n=== ===\n" << "made it past lock" << "\n-----------\n";
-        std::cerr << "Resize\n";
-        for (auto& l : locks0) l.lock();
-        // dont need both for (auto& l : locks1) l.lock();
+        std::unique_lock<std::shared_mutex> resize_guard(resize_mutex); // no walk in progress
+        // Pre-fault the doubled arrays before the buckets are locked; readers and writers
+        // keep going meanwhile, only other resizers and snapshots wait
+        std::vector<ProbeSet> fresh0 = take_array(2 * old_capacity);
+        std::vector<ProbeSet> fresh1 = take_array(2 * old_capacity);
+        lock_buckets(); // both tables: peek_front() locks table1 buckets on their own
+        elected.release(); // unlock_all() / the publish path below unlock it
 
         //try {
-            if (table_size != old_capacity) return; // already resized or locking issue
-
-            table_size *= 2;
-            std::vector<std::list<T>> temp0 = std::move(table0);;
-            std::vector<std::list<T>> temp1 = std::move(table1);;
-            //std::cout << "\n=== ===\n" << "made it past lock 1" << "\n-----------\n";
-            table0.assign(table_size, std::list<T>{});
-            table1.assign(table_size, std::list<T>{});
-            //std::cout << "\n=== ===\n" << "made it past lock 2" << "\n-----------\n";
-            //reassign locks
-            //locks0.assign(table_size, std::mutex{});
-            //locks1.assign(table_size, std::mutex{});
-            locks0 = std::vector<std::mutex>(table_size);
-            locks1 = std::vector<std::mutex>(table_size);
-            //std::cout << "\n=== ===\n" << "made it past lock 3" << "\n-----------\n";
-            std::uniform_int_distribution<size_t> dist;
-            seed = dist(rng);
-            seed1 = dist(rng);
-            //std::cout << "\n=== ===\n" << "made it past lock 4" << "\n-----------\n";
-            for (auto& row : temp0)
-                for (auto& x : row)
-                    add_internal(x);
-            //std::cout << "\n=== ===\n" << "made it past lock 5" << "\n-----------\n";
-            for (auto& row : temp1)
-                for (auto& x : row)
-                    add_internal(x);
+
+            // Sparse table: pick new seeds and redistribute within the current buckets.
+            // Otherwise (or if that cannot place everything) double by splitting buckets.
+            // Repeated sparse failures look like a flood: switch to the keyed hash.
+            std::list<T> leftovers;
+            bool grow = true;
+            bool sparse = size() < REHASH_LOAD * 2 * table_size * PROBE_SIZE;
+            if (!keyed && (want_keyed || (sparse && ++sparse_failures >= FLOOD_FAILURES))) {
+                if (!want_keyed) std::cerr << "Kick failures at low load, switching to keyed hash\n";
+                keyed = true;
+                sip_key = std::uniform_int_distribution<uint64_t>(1)(rng);
+                grow = !rehash_in_place(leftovers);
+            } else if (sparse && rehash_budget > 0) {
+                rehash_budget--;
+                grow = !rehash_in_place(leftovers);
+            }
+            std::vector<ProbeSet> old0, old1; // the locked arrays other threads can see
+            if (grow) {
+                std::cerr << "Resize\n";
+                do {
+                    split_grow(fresh0, fresh1);
+                    distribute(leftovers, PROBE_SIZE);
+                    if (old0.empty()) {
+                        old0.swap(fresh0);
+                        old1.swap(fresh1);
+                    }
+                } while (!leftovers.empty());
+                rehash_budget = MAX_REHASHES;
+                sparse_failures = 0;
+            }
+            layout_changes.fetch_add(1, std::memory_order_release);
+            // bucket layout changed, deltas against the old full snapshot are meaningless
+            dirty = std::vector<std::atomic<uint64_t>>(dirty_words(table_size));
+            needs_full = true;
+            if (grow) {
+                // the new arrays are unlocked and become visible here; anyone spinning on
+                // an old bucket sees RETIRED and goes to them. Still holding
+                // global_resize_lock, so grace periods never overlap.
+                publish();
+                for (auto& b : old0) b.header.fetch_or(RETIRED, std::memory_order_release);
+                for (auto& b : old1) b.header.fetch_or(RETIRED, std::memory_order_release);
+                wait_for_grace();
+                recycle_array(std::move(old0));
+                recycle_array(std::move(old1));
+                global_resize_lock.unlock();
+            } else {
+                unlock_all();
+            }
         //} catch (...) {
-        for (auto& l : locks0) l.unlock();
+        // whatever was not used (rehash path, or a split that had to be redone) goes back to the pool
+        recycle_array(std::move(fresh0));
+        recycle_array(std::move(fresh1));
         //std::cerr << "Resize done\n";
         //std::cerr << table_size << "\n";
           //  throw;
@@ -106,6 +966,103 @@ private:
         //std::cout << "\n=== ===\n" << "made it to end of resize" << "\n-----------\n";
     }
 
+    // Split every bucket b into b and b + old_capacity: (h % 2n) is either (h % n) or
+    // (h % n) + n, so no reseed and no reinsertion is needed, and a new bucket never
+    // holds more than its old bucket did (nothing is dropped)
+    // fresh0/fresh1 are the prepared arrays of the doubled size (taken from the pool if
+    // they do not fit); on return they hold the old, now empty, arrays.
+    void split_grow(std::vector<ProbeSet>& fresh0, std::vector<ProbeSet>& fresh1) {
+        int old_capacity = table_size;
+        table_size *= 2;
+        if ((int)fresh0.size() != table_size) fresh0 = take_array(table_size);
+        if ((int)fresh1.size() != table_size) fresh1 = take_array(table_size);
+        for (int b = 0; b < old_capacity; b++) {
+            // both halves continue the old bucket's version, so a version read before the
+            // resize (relocate()) cannot turn up again on the new bucket
+            for (int t = 0; t < 2; t++) {
+                auto& fresh = t == 0 ? fresh0 : fresh1;
+                uint64_t v = ((t == 0 ? table0 : table1)[b].header.load(std::memory_order_relaxed) & ~(LOCKED | RETIRED)) + VERSION_ONE;
+                fresh[b].header.store(v, std::memory_order_relaxed);
+                fresh[b + old_capacity].header.store(v, std::memory_order_relaxed);
+            }
+            fresh0[b] = std::move(table0[b]); // list move, the nodes stay where they are
+            fresh1[b] = std::move(table1[b]);
+            split_bucket(fresh0, b, old_capacity, 0);
+            split_bucket(fresh1, b, old_capacity, 1);
+        }
+        table0.swap(fresh0);
+        table1.swap(fresh1);
+    }
+
+    // An array of size empty buckets, reusing a pooled one when it has the capacity
+    std::vector<ProbeSet> take_array(int size) {
+        {
+            std::lock_guard<std::mutex> guard(spare_mutex);
+            for (size_t k = 0; k < spare_tables.size(); k++) {
+                if ((int)spare_tables[k].capacity() >= size) {
+                    std::vector<ProbeSet> v = std::move(spare_tables[k]);
+                    spare_tables.erase(spare_tables.begin() + k);
+                    v.resize(size); // constructs into pages that are already mapped
+                    return v;
+                }
+            }
+        }
+        return std::vector<ProbeSet>(size); // first touch happens here, not under the locks
+    }
+
+    // Arrays that were never published, that load_snapshot() replaced, or that resize()
+    // replaced and waited out (no other thread can still be spinning on those). The
+    // elements are destroyed here.
+    void recycle_array(std::vector<ProbeSet>&& v) {
+        if (v.capacity() == 0) return;
+        v.clear(); // keeps the capacity
+        std::lock_guard<std::mutex> guard(spare_mutex);
+        if (spare_tables.size() < MAX_SPARE_TABLES) spare_tables.push_back(std::move(v));
+    }
+
+    // Splice every pending node into one of its buckets that holds fewer than limit
+    // elements under the current seeds; nodes that fit nowhere stay in pending
+    void distribute(std::list<T>& pending, int limit) {
+        for (auto it = pending.begin(); it != pending.end();) {
+            auto next = std::next(it);
+            std::list<T>& set0 = table0[hash0(*it)];
+            std::list<T>& set1 = table1[hash1(*it)];
+            if ((int)set0.size() < limit) set0.splice(set0.end(), pending, it);
+            else if ((int)set1.size() < limit) set1.splice(set1.end(), pending, it);
+            it = next;
+        }
+    }
+
+    // Reseed without growing. All nodes are spliced into one pending list and back out
+    // into their new buckets (below THRESHOLD first, then up to PROBE_SIZE), so nothing
+    // is allocated. A few seed pairs are tried; on failure the elements that found no
+    // bucket are left in leftovers and everything else is placed under the last seeds.
+    bool rehash_in_place(std::list<T>& leftovers) {
+        std::cerr << "Rehash\n";
+        std::uniform_int_distribution<size_t> dist;
+        for (int attempt = 0; attempt < 3; attempt++) {
+            for (auto& b : table0) leftovers.splice(leftovers.end(), b);
+            for (auto& b : table1) leftovers.splice(leftovers.end(), b);
+            seed = dist(rng);
+            seed1 = dist(rng);
+            distribute(leftovers, THRESHOLD);
+            distribute(leftovers, PROBE_SIZE);
+            if (leftovers.empty()) return true;
+        }
+        return false;
+    }
+
+    // Move the elements of bucket b that now hash to b + old_capacity, keeping their order
+    void split_bucket(std::vector<ProbeSet>& table, int b, int old_capacity, int table_index) {
+        std::list<T>& from = table[b];
+        std::list<T>& to = table[b + old_capacity];
+        for (auto it = from.begin(); it != from.end();) {
+            auto next = std::next(it);
+            if ((table_index == 0 ? hash0(*it) : hash1(*it)) != b) to.splice(to.end(), from, it);
+            it = next;
+        }
+    }
+
     bool add_internal(const T& x) {
         // NOTE: Assume resize_mutex is held exclusively by the caller (resize())
         // and that bucket locks are free to use.
@@ -124,8 +1081,12 @@ private:
         
         if ((int)set0.size() < THRESHOLD) { // Threshold check is implicit when re-adding , maybe set to Probe_size
             set0.push_back(x); 
+            mark_dirty(h0);
+            note_added(x);
         } else if ((int)set1.size() < THRESHOLD) {  //, maybe set to Probe_size
             set1.push_back(x); 
+            mark_dirty(h1);
+            note_added(x);
         } else {
             // Re-adding elements during resize *must* succeed. 
             // If they fail, it's a structural error, but we treat it as an implicit resize fail.
@@ -140,6 +1101,81 @@ private:
         return true;
     }
 
+    static constexpr int SCAN_BATCH = 256; // elements per contains_batch() call in set algebra
+    static constexpr int BATCH_GROUP = 16; // keys whose buckets are prefetched together
+
+    // One line per bucket: the lock word is in it
+    void prefetch_group(const T* keys, int m) {
+        int n = live_size.load(std::memory_order_acquire);
+        ProbeSet* t0 = live0.load(std::memory_order_acquire);
+        ProbeSet* t1 = live1.load(std::memory_order_acquire);
+        for (int k = 0; k < m; k++) {
+            __builtin_prefetch(&t0[hash0(keys[k], n)]);
+            __builtin_prefetch(&t1[hash1(keys[k], n)]);
+        }
+    }
+
+    // Split the buckets of from into num_threads ranges; each worker copies the elements
+    // of a bucket pair under its locks and calls fn(thread, elements, count) per batch.
+    // Resizes of from wait until the walk is done, so no element moves out of a range
+    // that has not been visited yet.
+    template <typename Fn>
+    static void for_each_chunked(StripedCuckooHashSet& from, int num_threads, Fn fn) {
+        std::shared_lock<std::shared_mutex> no_resize(from.resize_mutex);
+        int buckets = from.table_size;
+        std::vector<std::thread> workers;
+        for (int t = 0; t < num_threads; t++) {
+            workers.emplace_back([&, t]() {
+                std::vector<T> batch;
+                batch.reserve(SCAN_BATCH + 2 * from.PROBE_SIZE);
+                for (long b = (long)buckets * t / num_threads; b < (long)buckets * (t + 1) / num_threads; b++) {
+                    from.lock_pair(b, b);
+                    batch.insert(batch.end(), from.table0[b].begin(), from.table0[b].end());
+                    batch.insert(batch.end(), from.table1[b].begin(), from.table1[b].end());
+                    from.unlock_pair(b, b);
+                    if ((int)batch.size() >= SCAN_BATCH) {
+                        fn(t, batch.data(), (int)batch.size());
+                        batch.clear();
+                    }
+                }
+                if (!batch.empty()) fn(t, batch.data(), (int)batch.size());
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+
+    // emit(thread, x) for every x of from whose membership in into equals want
+    template <typename Emit>
+    static void probe_chunks(StripedCuckooHashSet& from, StripedCuckooHashSet& into, bool want,
+                             int num_threads, Emit emit) {
+        for_each_chunked(from, num_threads, [&](int t, const T* xs, int n) {
+            std::unique_ptr<bool[]> hit(new bool[n]);
+            into.contains_batch(xs, n, hit.get());
+            for (int k = 0; k < n; k++) if (hit[k] == want) emit(t, xs[k]);
+        });
+    }
+
+    // Target fill of a collect() result: elements over the slots below THRESHOLD in both
+    // tables. The workers insert concurrently and unevenly, so a table sized to just hold
+    // the result would resize (locking everyone out) near the end of almost every fill.
+    static constexpr double COLLECT_LOAD = 0.4;
+
+    // Gather a stream_ result and insert it into a new set sized for it, one worker per part
+    template <typename Run>
+    std::unique_ptr<StripedCuckooHashSet> collect(Run run, int num_threads) {
+        std::vector<std::vector<T>> found(num_threads);
+        run([&](int t, const T& x) { found[t].push_back(x); });
+        size_t count = 0;
+        for (auto& part : found) count += part.size();
+        size_t buckets = count / (2 * THRESHOLD * COLLECT_LOAD) + 1;
+        auto result = std::make_unique<StripedCuckooHashSet>((int)buckets, LIMIT, PROBE_SIZE, THRESHOLD);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < num_threads; t++)
+            workers.emplace_back([&, t]() { for (auto& x : found[t]) result->add(x); });
+        for (auto& w : workers) w.join();
+        return result;
+    }
+
     bool present(const T& x) const{ //good
         int h0 = hash0(x);
         int h1 = hash1(x);
@@ -158,39 +1194,37 @@ private:
         { //resize scope
         //std::shared_lock<std::shared_mutex> resize_guard(resize_mutex);
         for (int round = 0; round < LIMIT; round++) {
-            std::list<T>& iSet = (i == 0 ? table0 : table1)[hi];
-            
-
-
-            // Check if iSet is below threshold (Fig. 13.27, line 91/94 check)
-            if ((int)iSet.size() < THRESHOLD) {
+            // Check if iSet is below threshold (Fig. 13.27, line 91/94 check), and get the
+            // oldest item (front) (Fig. 13.27, line 70) under iSet's lock alone
+            T y;
+            uint64_t seen;
+            if (!peek_front(i, hi, y, seen)) {
                 return true; // Set is now below threshold, successful relocation
             }
-            
-            // Get the oldest item (front) (Fig. 13.27, line 70)
-            T y = iSet.front(); 
-            //std::cout << "\n~~~~~~~~~~~~~~~~~`````````~~~~~~~~~~~~~\n" << y << "\n~~~~~~~~~~~~````````s~~~~~~~~~~~~~~~\n";
-            //std::cout << "\n~~~~~~~~~~~~~~~~~````````~~~~MADE IT HERE~~~~~~~~````````s~~~~~~~~~~~~~~~\n";
-            // Calculate the other hash (Fig. 13.27, line 71-74)
-            if (i == 0) {
-                hj = hash1(y); 
-            } else { // i == 1
-                hj = hash0(y);
-            }
-            
+
             // Acquire locks for the item y (Fig. 13.27, line 75)
             acquire(y);
-            
+            if ((i == 0 ? hash0(y) : hash1(y)) != hi) { // moved by a reseed, iSet is not ours
+                release(y);
+                continue;
+            }
+
+            // Calculate the other hash (Fig. 13.27, line 71-74)
+            hj = (j == 0) ? hash0(y) : hash1(y);
+
             // Now safe to access the probe sets of y's location
-            std::list<T>& jSet = (j == 0 ? table0 : table1)[hj];
-            
-        
+            ProbeSet& iSet = (i == 0 ? table0 : table1)[hi];
+            ProbeSet& jSet = (j == 0 ? table0 : table1)[hj];
 
             // Try block equivalent starts here
-            // Check if y is still in iSet and remove it (Fig. 13.27, line 78)
-            auto it = std::find(iSet.begin(), iSet.end(), y);
+            // Check if y is still in iSet and remove it (Fig. 13.27, line 78). An unchanged
+            // version means nobody held iSet since the peek, so y is still its front.
+            auto it = (iSet.header.load(std::memory_order_relaxed) & ~LOCKED) == seen
+                          ? iSet.begin() : std::find(iSet.begin(), iSet.end(), y);
             if (it != iSet.end()) { 
                 iSet.erase(it); // Successful removal (line 78), could replace with pop back but size is so small
+                mark_dirty(hi);
+                mark_dirty(hj);
                 
                 if ((int)jSet.size() < THRESHOLD) { // jSet is below threshold (line 79)
                     jSet.push_back(y); // Add to back of jSet
@@ -228,15 +1262,17 @@ public:
           THRESHOLD(threshold),
           table0(size),
           table1(size),
-          locks0(size),
-          locks1(size),
-          rng(std::mt19937(std::random_device{}())) {
+          rng(std::mt19937(std::random_device{}())),
+          instance_id(next_instance_id.fetch_add(1)),
+          dirty(dirty_words(size)) {
         std::uniform_int_distribution<size_t> dist;
         seed = dist(rng);
         seed1 = dist(rng);
+        publish();
     }
 
     bool contains(const T& x) { //good
+        if (negative_cache) return contains_cached(x);
         // Block if a resize is in progress
         //std::cout << "\n=== in contains ===\n";
         //std::shared_lock<std::shared_mutex> resize_guard(resize_mutex);
@@ -252,6 +1288,7 @@ public:
         // Block if a resize is in progress
         bool mustResize = false;
         int i = -1, h = -1; // row and column for relocation
+        uint64_t lsn = 0;
         {// set scoped block so resize guard gives out
         //std::shared_lock<std::shared_mutex> resize_guard(resize_mutex);
         acquire(x);
@@ -265,19 +1302,20 @@ public:
         std::list<T>& set0 = table0[h0]; 
         std::list<T>& set1 = table1[h1]; 
         if ((int)set0.size() < THRESHOLD) { 
-            set0.push_back(x); release(x); return true; 
+            set0.push_back(x); mark_dirty(h0); note_added(x); lsn = log_op(WAL_ADD, x); release(x); sync_log(lsn); return true; 
         } else if ((int)set1.size() < THRESHOLD) { 
-            set1.push_back(x); release(x); return true; 
+            set1.push_back(x); mark_dirty(h1); note_added(x); lsn = log_op(WAL_ADD, x); release(x); sync_log(lsn); return true; 
         } else if ((int)set0.size() < PROBE_SIZE) { 
-            set0.push_back(x); i = 0; h = h0; 
+            set0.push_back(x); mark_dirty(h0); note_added(x); lsn = log_op(WAL_ADD, x); i = 0; h = h0; 
         } else if ((int)set1.size() < PROBE_SIZE) { 
-            set1.push_back(x); i = 1; h = h1; 
+            set1.push_back(x); mark_dirty(h1); note_added(x); lsn = log_op(WAL_ADD, x); i = 1; h = h1; 
         } else {
             mustResize = true; 
         }
         
         release(x);
-        } // <-- resize_guard (Shared Lock on resize_mutex) is RELEASED here automatically
+        }
+        sync_log(lsn); // <-- resize_guard (Shared Lock on resize_mutex) is RELEASED here automatically
        // std::cout << "\n=== add lock released ===\n";
         if (mustResize) { 
             //std::cout << "\n=== hash1 ===\n" << "attempting to resize" << "\n-----------\n";
@@ -287,7 +1325,9 @@ public:
             if (!relocate(i, h)) { 
                 //std::cout << "\n=== hash1 ===\n" << "attempting to resize" << "\n-----------\n";
                 resize(); 
-                return add(x); // Recursive add(x) for the element that failed relocation 
+                // x itself is already stored (only the relocation failed), re-adding it would
+                // report it as a duplicate, which add_batch()/dedup rely on not happening
+                return true;
             }
         }
 
@@ -310,14 +1350,20 @@ public:
 
         if (it0 != set0.end()) { // line 19
             set0.erase(it0); // line 20
+            mark_dirty(h0);
+            uint64_t lsn = log_op(WAL_REMOVE, x);
             release(x);
+            sync_log(lsn);
             return true;
         } else {
             std::list<T>& set1 = table1[h1];
             auto it1 = std::find(set1.begin(), set1.end(), x);
             if (it1 != set1.end()) { // line 24
                 set1.erase(it1); // line 25
+                mark_dirty(h1);
+                uint64_t lsn = log_op(WAL_REMOVE, x);
                 release(x);
+                sync_log(lsn);
                 return true;
             }
         }
@@ -325,6 +1371,360 @@ public:
         return false; // line 29
     }
 
+    // What atomic_apply() hands to fn: add/remove/contains on the declared keys only,
+    // applied directly under their locks and undone in reverse if the batch is abandoned
+    class AtomicBatch {
+    private:
+        friend class StripedCuckooHashSet;
+        StripedCuckooHashSet& set;
+        const std::vector<int>& held0; // sorted bucket indices locked by atomic_apply()
+        const std::vector<int>& held1;
+        std::vector<std::pair<WalOp, T>> done;
+        bool out_of_room = false;
+
+        AtomicBatch(StripedCuckooHashSet& s, const std::vector<int>& h0, const std::vector<int>& h1)
+            : set(s), held0(h0), held1(h1) {}
+
+        void check_held(const T& x) const {
+            if (!std::binary_search(held0.begin(), held0.end(), set.hash0(x)) ||
+                !std::binary_search(held1.begin(), held1.end(), set.hash1(x)))
+                throw std::logic_error("atomic_apply: key was not declared");
+        }
+
+        // relocate() would need locks we do not hold, so only free slots are used
+        bool insert(const T& x) {
+            std::list<T>& set0 = set.table0[set.hash0(x)];
+            std::list<T>& set1 = set.table1[set.hash1(x)];
+            if ((int)set0.size() < set.THRESHOLD || ((int)set0.size() < set.PROBE_SIZE && (int)set1.size() >= set.THRESHOLD)) {
+                set0.push_back(x);
+                set.mark_dirty(set.hash0(x));
+                set.note_added(x);
+            } else if ((int)set1.size() < set.PROBE_SIZE) {
+                set1.push_back(x);
+                set.mark_dirty(set.hash1(x));
+                set.note_added(x);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        bool erase(const T& x) {
+            for (int t = 0; t < 2; t++) {
+                int h = (t == 0) ? set.hash0(x) : set.hash1(x);
+                std::list<T>& b = (t == 0 ? set.table0 : set.table1)[h];
+                auto it = std::find(b.begin(), b.end(), x);
+                if (it != b.end()) {
+                    b.erase(it);
+                    set.mark_dirty(h);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void rollback() {
+            for (auto it = done.rbegin(); it != done.rend(); ++it) {
+                if (it->first == WAL_ADD) erase(it->second);
+                else insert(it->second); // its slot was freed by the remove, so this fits
+            }
+            done.clear();
+        }
+
+    public:
+        bool contains(const T& x) {
+            check_held(x);
+            return set.present(x);
+        }
+
+        // Both buckets full makes the whole batch retry after a resize, fn runs again
+        bool add(const T& x) {
+            check_held(x);
+            if (out_of_room || set.present(x)) return false;
+            if (!insert(x)) {
+                out_of_room = true;
+                return false;
+            }
+            done.push_back({WAL_ADD, x});
+            return true;
+        }
+
+        bool remove(const T& x) {
+            check_held(x);
+            if (out_of_room || !erase(x)) return false;
+            done.push_back({WAL_REMOVE, x});
+            return true;
+        }
+    };
+
+    // Run fn(AtomicBatch&) with the stripes of every key in keys held, so its adds and
+    // removes become visible all at once (e.g. move x out and y in). Locks are taken in
+    // one global order (table 0 buckets ascending, then table 1), the same order as
+    // acquire() and resize(), so batches cannot deadlock with anything. If fn returns
+    // false its changes are undone and atomic_apply returns false. fn may run more than
+    // once (after a resize when an add found no room) and must only touch declared keys.
+    template <typename Fn>
+    bool atomic_apply(const std::vector<T>& keys, Fn fn) {
+        while (true) {
+            std::vector<int> held0, held1;
+            int n = live_size.load(std::memory_order_acquire);
+            size_t s0 = seed, s1 = seed1;
+            for (const T& k : keys) {
+                held0.push_back(hash0(k, n));
+                held1.push_back(hash1(k, n));
+            }
+            std::sort(held0.begin(), held0.end());
+            held0.erase(std::unique(held0.begin(), held0.end()), held0.end());
+            std::sort(held1.begin(), held1.end());
+            held1.erase(std::unique(held1.begin(), held1.end()), held1.end());
+            // each bucket once, in index order; as in lock_pair() only the first table0
+            // bucket can turn out RETIRED
+            for (LockPhase phase(*this); !held0.empty();) {
+                ProbeSet* t0 = live0.load();
+                if (!lock_bucket(t0[held0[0]])) continue;
+                for (size_t k = 1; k < held0.size(); k++) lock_bucket(t0[held0[k]]);
+                ProbeSet* t1 = live1.load();
+                for (int h : held1) lock_bucket(t1[h]);
+                break;
+            }
+            auto unlock = [&]() {
+                for (int h : held1) unlock_bucket(table1[h]);
+                for (int h : held0) unlock_bucket(table0[h]);
+            };
+            if (table_size != n || seed != s0 || seed1 != s1) { // resized or reseeded meanwhile, indices are stale
+                unlock();
+                continue;
+            }
+
+            AtomicBatch batch(*this, held0, held1);
+            bool ok;
+            try {
+                ok = fn(batch) && !batch.out_of_room;
+            } catch (...) {
+                batch.rollback();
+                unlock();
+                throw;
+            }
+            if (!ok) {
+                bool retry = batch.out_of_room;
+                batch.rollback();
+                unlock();
+                if (!retry) return false;
+                resize();
+                continue;
+            }
+            uint64_t lsn = 0;
+            for (auto& op : batch.done) lsn = log_op(op.first, op.second);
+            unlock();
+            sync_log(lsn); // one group commit covers the whole batch
+            return true;
+        }
+    }
+
+    // Hash with SipHash from now on, for untrusted keys (it also switches by itself when
+    // an attack is detected). The elements are rehashed in place with writers stopped.
+    void use_keyed_hash() {
+        want_keyed = true;
+        resize();
+    }
+
+    // Cache recent contains() misses per thread (see EPOCH_STRIPES), for workloads that ask
+    // for the same absent keys again and again: a repeated miss skips the locks and the
+    // bucket probes. Adds pay one atomic increment. Call before other threads use the set.
+    void use_negative_cache() {
+        if (negative_cache) return;
+        epochs.reset(new Epoch[EPOCH_STRIPES]);
+        negative_cache = true;
+    }
+
+    // Log every successful add/remove to wal from now on (nullptr turns logging off).
+    // Call replay_log() first so recovered operations are not logged twice.
+    void attach_log(WriteAheadLog<T>* log) {
+        wal = log;
+    }
+
+    // Re-apply the operations recorded in the WAL at path on top of the current contents,
+    // skipping the ones the loaded snapshot (if any) already holds
+    void replay_log(const char* path) {
+        WriteAheadLog<T>::replay(path, [this](WalOp op, const T& x) {
+            if (op == WAL_ADD) add(x);
+            else if (op == WAL_REMOVE) remove(x);
+        }, snapshot_lsn);
+    }
+
+    // Write every bucket to path and start a new delta chain. The table is copied to
+    // memory with writers stopped, the file write happens after they resume. With a log
+    // attached the snapshot records the last lsn it holds, and once the file is on disk
+    // the log drops every record up to it.
+    void save_snapshot(const std::string& path) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots store raw copies of T");
+        std::vector<char> out(sizeof(SnapshotHeader));
+        lock_all();
+        std::uniform_int_distribution<uint64_t> dist(1);
+        // every add/remove logs while holding its bucket locks, so with all of them held
+        // the table reflects exactly the records up to last_lsn()
+        SnapshotHeader h{FULL_MAGIC, SNAPSHOT_VERSION, (uint32_t)table_size, 0, seed, seed1, dist(rng), 0, (uint64_t)table_size,
+                         keyed ? sip_key : 0, wal ? wal->last_lsn() : 0};
+        std::memcpy(out.data(), &h, sizeof(h));
+        for (auto& b : table0) append_bucket(out, b);
+        for (auto& b : table1) append_bucket(out, b);
+        for (auto& w : dirty) w.store(0, std::memory_order_relaxed);
+        snapshot_id = h.snapshot_id;
+        delta_seq = 0;
+        needs_full = false;
+        unlock_all();
+        write_file(path, out);
+        if (wal && h.lsn) wal->truncate(h.lsn);
+    }
+
+    // Write only the blocks changed since the last full or delta snapshot.
+    // Returns false (and writes nothing) if a full snapshot is required first.
+    bool save_delta(const std::string& path) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots store raw copies of T");
+        std::vector<char> out(sizeof(SnapshotHeader));
+        lock_all();
+        if (needs_full) {
+            unlock_all();
+            return false;
+        }
+        SnapshotHeader h{DELTA_MAGIC, SNAPSHOT_VERSION, (uint32_t)table_size, 0, seed, seed1, snapshot_id, ++delta_seq, 0,
+                         keyed ? sip_key : 0, wal ? wal->last_lsn() : 0};
+        for (size_t w = 0; w < dirty.size(); w++) {
+            uint64_t bits = dirty[w].exchange(0, std::memory_order_relaxed);
+            for (; bits; bits &= bits - 1) {
+                uint32_t block = w * 64 + __builtin_ctzll(bits);
+                const char* p = reinterpret_cast<const char*>(&block);
+                out.insert(out.end(), p, p + sizeof(block));
+                int first = block * BLOCK_BUCKETS;
+                int last = std::min(first + BLOCK_BUCKETS, table_size);
+                for (int b = first; b < last; b++) append_bucket(out, table0[b]);
+                for (int b = first; b < last; b++) append_bucket(out, table1[b]);
+                h.count++;
+            }
+        }
+        unlock_all();
+        std::memcpy(out.data(), &h, sizeof(h));
+        write_file(path, out);
+        return true;
+    }
+
+    // Fold deltas into their full snapshot, producing a new full snapshot at out_path.
+    // Only touches files, so it can run on a background thread while the table is live.
+    static void compact_snapshots(const std::string& full_path, const std::vector<std::string>& delta_paths,
+                                  const std::string& out_path) {
+        SnapshotImage img;
+        read_full(full_path, img);
+        for (auto& d : delta_paths) apply_delta(d, img);
+        write_full(out_path, img);
+    }
+
+    // Replace the contents with a full snapshot plus its deltas (in chain order).
+    // Not safe to call while other threads use the table.
+    void load_snapshot(const std::string& full_path, const std::vector<std::string>& delta_paths = {}) {
+        SnapshotImage img;
+        read_full(full_path, img);
+        for (auto& d : delta_paths) apply_delta(d, img);
+
+        table_size = img.header.table_size;
+        seed = img.header.seed;
+        seed1 = img.header.seed1;
+        keyed = img.header.sip_key != 0;
+        sip_key = img.header.sip_key;
+        std::vector<ProbeSet> fresh0 = take_array(table_size);
+        std::vector<ProbeSet> fresh1 = take_array(table_size);
+        table0.swap(fresh0);
+        table1.swap(fresh1);
+        // nobody else is using the set, so the replaced arrays can go back to the pool
+        // (or be freed once it is full)
+        recycle_array(std::move(fresh0));
+        recycle_array(std::move(fresh1));
+        for (int b = 0; b < table_size; b++) {
+            table0[b].assign(img.buckets[b].begin(), img.buckets[b].end());
+            table1[b].assign(img.buckets[table_size + b].begin(), img.buckets[table_size + b].end());
+        }
+        publish();
+        layout_changes.fetch_add(1, std::memory_order_release);
+        dirty = std::vector<std::atomic<uint64_t>>(dirty_words(table_size));
+        snapshot_id = img.header.snapshot_id;
+        snapshot_lsn = img.header.lsn;
+        delta_seq = img.header.seq;
+        needs_full = false;
+        if (negative_cache) // anything may have appeared
+            for (int k = 0; k < EPOCH_STRIPES; k++) epochs[k].value.fetch_add(1);
+    }
+
+    // Free the bucket arrays kept for reuse by resize()
+    void release_spare_arrays() {
+        std::lock_guard<std::mutex> guard(spare_mutex);
+        spare_tables.clear();
+    }
+
+    // Look up n keys: the buckets of a group of keys (lock words included) are prefetched
+    // before the first of them is locked, so the cache misses of the group overlap
+    void contains_batch(const T* keys, int n, bool* out) {
+        for (int base = 0; base < n; base += BATCH_GROUP) {
+            int m = std::min(BATCH_GROUP, n - base);
+            prefetch_group(keys + base, m);
+            for (int k = 0; k < m; k++) out[base + k] = contains(keys[base + k]);
+        }
+    }
+
+    // Add n keys in order; bit k % 64 of was_new[k / 64] is set if keys[k] was not
+    // present (so a repeat later in the same batch is not new). Prefetched like
+    // contains_batch().
+    void add_batch(const T* keys, int n, uint64_t* was_new) {
+        for (int w = 0; w < (n + 63) / 64; w++) was_new[w] = 0;
+        for (int base = 0; base < n; base += BATCH_GROUP) {
+            int m = std::min(BATCH_GROUP, n - base);
+            prefetch_group(keys + base, m);
+            for (int k = base; k < base + m; k++)
+                if (add(keys[k])) was_new[k / 64] |= 1ull << (k % 64);
+        }
+    }
+
+    // Set algebra, same interface as CuckooHashSet: stream_ versions call emit(thread, x)
+    // from num_threads workers, the others fill a new set (in parallel). Each worker copies
+    // a range of buckets out under their locks and probes the other set with
+    // contains_batch(), so adds/removes may run meanwhile (an element changed during the
+    // call may or may not be reported). A resize of the set being walked waits for the
+    // walk, so an emit that adds to that set can deadlock once it has to grow.
+    template <typename Emit>
+    void stream_intersection(StripedCuckooHashSet& other, int num_threads, Emit emit) {
+        bool this_smaller = size() <= other.size();
+        StripedCuckooHashSet& small = this_smaller ? *this : other;
+        StripedCuckooHashSet& large = this_smaller ? other : *this;
+        probe_chunks(small, large, true, num_threads, emit);
+    }
+
+    template <typename Emit>
+    void stream_difference(StripedCuckooHashSet& other, int num_threads, Emit emit) {
+        probe_chunks(*this, other, false, num_threads, emit);
+    }
+
+    // All of the larger set, then what the smaller set adds to it
+    template <typename Emit>
+    void stream_union(StripedCuckooHashSet& other, int num_threads, Emit emit) {
+        bool this_smaller = size() <= other.size();
+        StripedCuckooHashSet& small = this_smaller ? *this : other;
+        StripedCuckooHashSet& large = this_smaller ? other : *this;
+        for_each_chunked(large, num_threads, [&](int t, const T* xs, int n) {
+            for (int k = 0; k < n; k++) emit(t, xs[k]);
+        });
+        probe_chunks(small, large, false, num_threads, emit);
+    }
+
+    std::unique_ptr<StripedCuckooHashSet> set_intersection(StripedCuckooHashSet& other, int num_threads = 1) {
+        return collect([&](auto emit) { stream_intersection(other, num_threads, emit); }, num_threads);
+    }
+
+    std::unique_ptr<StripedCuckooHashSet> set_difference(StripedCuckooHashSet& other, int num_threads = 1) {
+        return collect([&](auto emit) { stream_difference(other, num_threads, emit); }, num_threads);
+    }
+
+    std::unique_ptr<StripedCuckooHashSet> set_union(StripedCuckooHashSet& other, int num_threads = 1) {
+        return collect([&](auto emit) { stream_union(other, num_threads, emit); }, num_threads);
+    }
+
     int size() { //good
         int count = 0;
         for (auto& bucket : table0) count += bucket.size();
@@ -332,6 +1732,16 @@ public:
         return count;
     }
 
+    // Build a read-only copy with offline placement, for sets that stop changing
+    FrozenCuckooHashSet<T> freeze(double load = 0.95) {
+        std::vector<T> keys;
+        lock_all();
+        for (auto& b : table0) keys.insert(keys.end(), b.begin(), b.end());
+        for (auto& b : table1) keys.insert(keys.end(), b.begin(), b.end());
+        unlock_all();
+        return FrozenCuckooHashSet<T>(keys, load);
+    }
+
     void populate(int n) { //good
         std::uniform_int_distribution<int> dist(0, n * 8);
         for (int i = 0; i < n; ++i)
@@ -352,7 +1762,7 @@ public:
         for (size_t i = 0; i < table0.size(); ++i) {
             std::cout << "  Bucket [" << i << "]: ";
             
-            // NOTE: Must lock the individual bucket mutex before accessing the bucket contents
+            // NOTE: Must lock the individual bucket before accessing the bucket contents
             // Locking all locks would be impractical for printing, so we'll skip the bucket locks
             // for simple diagnostic printing, but note that concurrent access is UNSAFE here.
             
@@ -364,9 +1774,8 @@ public:
                 }
                 std::cout << "[END]";
             }
-            // Print the address of the associated lock
-            // We cannot print the lock status (locked/unlocked)
-            std::cout << " | Lock Address: " << &locks0[i] << "\n";
+            // Print the bucket's lock word
+            std::cout << " | Lock Word: " << table0[i].header.load() << "\n";
         }
         std::cout << "-------------------------------------\n";
 
@@ -385,8 +1794,8 @@ public:
                 }
                 std::cout << "[END]";
             }
-            // Print the address of the associated lock
-            std::cout << " | Lock Address: " << &locks1[i] << "\n";
+            // Print the bucket's lock word
+            std::cout << " | Lock Word: " << table1[i].header.load() << "\n";
         }
         std::cout << "-------------------------------------\n";
     }
@@ -395,7 +1804,70 @@ public:
 // =========================
 // Benchmark Driver (Same as Baseline)
 // =========================
-int main() {
+// dedup: stream keys (one per line) from the given files, or stdin, and print only the
+// first occurrence of each. Every input is a partition read by its own thread in chunks
+// of DEDUP_CHUNK lines; a chunk goes through add_batch() and its new lines are written
+// as one block, so output keeps each partition's order. Counts go to stderr.
+constexpr int DEDUP_CHUNK = 4096;
+
+int run_dedup(int num_inputs, char** inputs) {
+    StripedCuckooHashSet<std::string> seen(1 << 16, 100, 4, 2);
+    std::mutex out_mutex;
+    std::atomic<long> lines_read{0}, lines_kept{0};
+
+    auto partition = [&](std::istream& in) {
+        std::vector<std::string> chunk(DEDUP_CHUNK);
+        std::vector<uint64_t> was_new((DEDUP_CHUNK + 63) / 64);
+        std::string out;
+        while (in) {
+            int n = 0;
+            while (n < DEDUP_CHUNK && std::getline(in, chunk[n])) n++;
+            if (n == 0) break;
+            seen.add_batch(chunk.data(), n, was_new.data());
+            out.clear();
+            long kept = 0;
+            for (int k = 0; k < n; k++) {
+                if (was_new[k / 64] >> (k % 64) & 1) {
+                    out += chunk[k];
+                    out += '\n';
+                    kept++;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> guard(out_mutex);
+                std::fwrite(out.data(), 1, out.size(), stdout);
+            }
+            lines_read += n;
+            lines_kept += kept;
+        }
+    };
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (num_inputs == 0) {
+        partition(std::cin);
+    } else {
+        std::vector<std::thread> readers;
+        for (int f = 0; f < num_inputs; f++) {
+            readers.emplace_back([&, f]() {
+                std::ifstream in(inputs[f]);
+                if (!in) {
+                    std::cerr << "dedup: cannot open " << inputs[f] << "\n";
+                    return;
+                }
+                partition(in);
+            });
+        }
+        for (auto& r : readers) r.join();
+    }
+    std::fflush(stdout);
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start_time;
+    std::cerr << "dedup: " << lines_read << " lines, " << lines_kept << " unique, "
+              << duration.count() << " seconds\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "dedup") return run_dedup(argc - 2, argv + 2);
     /**
     int initial_size = 3;  // Use a small size for easy inspection
     int limit = 100;
@@ -482,13 +1954,29 @@ int main() {
     double insert_ratio = 0.10;
     double remove_ratio = 0.10;
     double contains_ratio = 0.80;
+    double move_ratio = 0.0;    // taken out of contains: atomic_apply replacing key with key + 1
     int probe_size = 4;
     int threshold = 2;
+    bool use_wal = false;       // log adds/removes with group commit (populate is not logged)
+    bool keyed_hash = false;    // SipHash from the start, for untrusted keys
+    bool freeze_after = false;  // build a read-only FrozenCuckooHashSet from the final contents
+    bool negative_cache = false; // per-thread cache of recent contains() misses
+    int hot_misses = 0;         // > 0: contains() asks for one of this many absent keys instead
+    const char* wal_path = "striped_cuckoo.wal";
 
     StripedCuckooHashSet<int> set(initial_size, limit, probe_size, threshold);
     //set.print();
+    if (keyed_hash) set.use_keyed_hash();
+    if (negative_cache) set.use_negative_cache();
     set.populate(initial_size*0.5); //initial_size / 2
 
+    std::unique_ptr<WriteAheadLog<int>> wal;
+    if (use_wal) {
+        set.replay_log(wal_path);
+        wal = std::make_unique<WriteAheadLog<int>>(wal_path);
+        set.attach_log(wal.get());
+    }
+
     int ops_per_thread = total_ops / num_threads;
     int final_computed_size = set.size();
     std::vector<int> computed_size(num_threads, 0);
@@ -513,8 +2001,13 @@ int main() {
                 } else if (op_choice < insert_ratio + remove_ratio) {
                     if (set.remove(key))
                         computed_size[t]--;
+                } else if (op_choice < insert_ratio + remove_ratio + move_ratio) {
+                    // both or neither, the size never changes
+                    set.atomic_apply({key, key + 1}, [&](auto& batch) {
+                        return batch.remove(key) && batch.add(key + 1);
+                    });
                 } else {
-                    set.contains(key);
+                    set.contains(hot_misses > 0 ? -1 - key % hot_misses : key); // keys are >= 0
                 }
             }
         });
@@ -533,10 +2026,21 @@ int main() {
     std::cout << "Expected final size: " << final_computed_size << "\n";
     std::cout << "Actual final size:   " << set.size() << "\n";
     std::cout << "Time taken:          " << duration.count() << " seconds\n";
+
+    if (freeze_after) {
+        auto freeze_start = std::chrono::high_resolution_clock::now();
+        FrozenCuckooHashSet<int> frozen = set.freeze();
+        std::chrono::duration<double> freeze_time = std::chrono::high_resolution_clock::now() - freeze_start;
+        std::cout << "Frozen size:         " << frozen.size() << "\n";
+        std::cout << "Frozen load factor:  " << frozen.load_factor() << "\n";
+        std::cout << "Frozen memory:       " << frozen.memory_bytes() << " bytes\n";
+        std::cout << "Freeze time:         " << freeze_time.count() << " seconds\n";
+    }
     //*/
     return 0;
 }
 
 // g++ -std=c++17 -O2 -pthread stripedCuckooHash.cpp -o striped_cuckoo_hash
 //./striped_cuckoo_hash
+//./striped_cuckoo_hash dedup ids1.txt ids2.txt > unique.txt   (or: ... dedup < ids.txt)
 
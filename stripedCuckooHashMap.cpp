@@ -0,0 +1,771 @@
+#include <vector>
+#include <optional>
+#include <functional>
+#include <random>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <stdexcept>
+
+// g++ -std=c++17 -O2 -pthread stripedCuckooHashMap.cpp -o striped_cuckoo_map
+
+// Fixed size value storage for values too big (or not trivially copyable) to sit in a
+// slot. Values live in chunks of CHUNK values that never move; a value is named by a
+// 32 bit handle (chunk << CHUNK_BITS | index). alloc/release take a mutex, get() does
+// not: whoever holds a handle (read under a stripe lock) sees its chunk published.
+template <typename V>
+class ValueSlab {
+private:
+    static constexpr int CHUNK_BITS = 16;
+    static constexpr uint32_t CHUNK = 1u << CHUNK_BITS;
+    static constexpr uint32_t MAX_CHUNKS = 1u << (32 - CHUNK_BITS);
+
+    struct alignas(V) Cell {
+        unsigned char bytes[sizeof(V)];
+    };
+
+    std::unique_ptr<std::atomic<Cell*>[]> chunks;
+    uint32_t num_chunks = 0;
+    uint32_t next_free = 0;      // first never used index in the last chunk
+    std::vector<uint32_t> freed; // released handles, reused first
+    std::mutex slab_mutex;
+
+    V* cell(uint32_t handle) const {
+        Cell* c = chunks[handle >> CHUNK_BITS].load(std::memory_order_acquire);
+        return reinterpret_cast<V*>(&c[handle & (CHUNK - 1)]);
+    }
+
+public:
+    ValueSlab() : chunks(new std::atomic<Cell*>[MAX_CHUNKS]) {
+        for (uint32_t c = 0; c < MAX_CHUNKS; c++) chunks[c].store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~ValueSlab() { // live values are destroyed by the map, this only frees memory
+        for (uint32_t c = 0; c < num_chunks; c++) delete[] chunks[c].load(std::memory_order_relaxed);
+    }
+
+    ValueSlab(const ValueSlab&) = delete;
+    ValueSlab& operator=(const ValueSlab&) = delete;
+
+    uint32_t alloc(const V& value) {
+        uint32_t handle;
+        {
+            std::lock_guard<std::mutex> guard(slab_mutex);
+            if (!freed.empty()) {
+                handle = freed.back();
+                freed.pop_back();
+            } else {
+                if (num_chunks == 0 || next_free == CHUNK) {
+                    if (num_chunks == MAX_CHUNKS) throw std::bad_alloc();
+                    chunks[num_chunks++].store(new Cell[CHUNK], std::memory_order_release);
+                    next_free = 0;
+                }
+                handle = ((num_chunks - 1) << CHUNK_BITS) | next_free++;
+            }
+        }
+        new (cell(handle)) V(value);
+        return handle;
+    }
+
+    void release(uint32_t handle) {
+        cell(handle)->~V();
+        std::lock_guard<std::mutex> guard(slab_mutex);
+        freed.push_back(handle);
+    }
+
+    V& get(uint32_t handle) const {
+        return *cell(handle);
+    }
+};
+
+// Striped cuckoo hash map, same algorithm as StripedCuckooHashSet (two tables, probe
+// sets of PROBE_SIZE with THRESHOLD, relocate() moving the oldest element) but with
+// flat buckets of fixed size slot records instead of std::lists.
+// Values of at most INLINE_BYTES that are trivially copyable are stored in the slot;
+// anything bigger goes to a ValueSlab and the slot keeps a 32 bit handle, so kicks and
+// resize only ever move small {key, value-or-handle} records.
+template <typename K, typename V>
+class StripedCuckooHashMap {
+private:
+    static constexpr size_t INLINE_BYTES = 16;
+    static constexpr bool INLINE_VALUE = sizeof(V) <= INLINE_BYTES && std::is_trivially_copyable<V>::value;
+    using Stored = std::conditional_t<INLINE_VALUE, V, uint32_t>;
+
+    struct Slot {
+        K key;
+        Stored value;
+    };
+
+    int LIMIT;            // Max displacements before resize
+    int table_size;       // Number of buckets per table
+    int PROBE_SIZE;       // Max elements per bucket
+    int THRESHOLD;        // Threshold of when to relocate
+
+    // Bucket b of a table is slots[b * PROBE_SIZE .. b * PROBE_SIZE + counts[b]), oldest first
+    std::vector<Slot> slots0;
+    std::vector<Slot> slots1;
+    std::vector<uint8_t> counts0;
+    std::vector<uint8_t> counts1;
+
+    // Lock striping: the lock arrays keep their initial size and bucket b uses lock
+    // b % locks.size(). Tables only double, so a key keeps its lock across resizes
+    // and the index can be taken from the raw hash.
+    std::vector<std::mutex> locks0;
+    std::vector<std::mutex> locks1;
+
+    // What get_batch() prefetches through without holding a lock: the arrays and their
+    // size as of the last resize(), stored under all locks. A reader may combine a new
+    // size with an old array, which only costs a useless prefetch (prefetches never fault).
+    std::atomic<Slot*> live_slots0{nullptr};
+    std::atomic<Slot*> live_slots1{nullptr};
+    std::atomic<uint8_t*> live_counts0{nullptr};
+    std::atomic<uint8_t*> live_counts1{nullptr};
+    std::atomic<int> live_size{0};
+
+    struct NoSlab {};
+    std::conditional_t<INLINE_VALUE, NoSlab, ValueSlab<V>> slab;
+
+    // Random seeds for hashing
+    size_t seed, seed1;
+    std::mt19937 rng;
+    std::hash<K> hasher;
+
+    // murmur3's 64-bit finalizer. std::hash is the identity for integers, and then
+    // (key ^ seed) % n and (key ^ seed1) % n for a power of two n (which doubling from one
+    // gives) are the same permutation of the low bits: keys sharing a bucket in table 0
+    // share one in table 1 as well, and kicks cannot separate them.
+    static uint64_t fmix64(uint64_t h) {
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 33);
+    }
+
+    size_t raw0(const K& key) const {
+        return fmix64(hasher(key) ^ seed);
+    }
+
+    size_t raw1(const K& key) const {
+        return fmix64(hasher(key) ^ seed1);
+    }
+
+    // Only called with one of the key's locks held, resize() holds all of them
+    int hash0(const K& key) const {
+        return raw0(key) % table_size;
+    }
+
+    int hash1(const K& key) const {
+        return raw1(key) % table_size;
+    }
+
+    // Lock both stripes for a key (table 0 first, to avoid deadlock)
+    void acquire(const K& key) {
+        locks0[raw0(key) % locks0.size()].lock();
+        locks1[raw1(key) % locks1.size()].lock();
+    }
+
+    void release(const K& key) {
+        locks0[raw0(key) % locks0.size()].unlock();
+        locks1[raw1(key) % locks1.size()].unlock();
+    }
+
+    Slot* bucket(int table_index, int h) {
+        return (table_index == 0 ? slots0 : slots1).data() + (size_t)h * PROBE_SIZE;
+    }
+
+    uint8_t& count(int table_index, int h) {
+        return (table_index == 0 ? counts0 : counts1)[h];
+    }
+
+    // Slot holding key, or nullptr
+    Slot* find(const K& key) {
+        int h0 = hash0(key);
+        Slot* b0 = bucket(0, h0);
+        for (int k = 0; k < counts0[h0]; k++) if (b0[k].key == key) return &b0[k];
+        int h1 = hash1(key);
+        Slot* b1 = bucket(1, h1);
+        for (int k = 0; k < counts1[h1]; k++) if (b1[k].key == key) return &b1[k];
+        return nullptr;
+    }
+
+    Stored store(const V& value) {
+        if constexpr (INLINE_VALUE) return value;
+        else return slab.alloc(value);
+    }
+
+    V& load(Slot& s) {
+        if constexpr (INLINE_VALUE) return s.value;
+        else return slab.get(s.value);
+    }
+
+    void drop(Slot& s) {
+        if constexpr (!INLINE_VALUE) slab.release(s.value);
+    }
+
+    void push_back(int table_index, int h, Slot&& s) {
+        uint8_t& c = count(table_index, h);
+        bucket(table_index, h)[c++] = std::move(s);
+    }
+
+    // Remove slot k of a bucket, keeping the rest in age order
+    Slot erase(int table_index, int h, int k) {
+        Slot* b = bucket(table_index, h);
+        uint8_t& c = count(table_index, h);
+        Slot s = std::move(b[k]);
+        for (int m = k + 1; m < c; m++) b[m - 1] = std::move(b[m]);
+        c--;
+        return s;
+    }
+
+    // Both lock arrays: relocate() reads a bucket under a single stripe of either table
+    void lock_all() {
+        for (auto& l : locks0) l.lock();
+        for (auto& l : locks1) l.lock();
+    }
+
+    void unlock_all() {
+        for (auto& l : locks1) l.unlock();
+        for (auto& l : locks0) l.unlock();
+    }
+
+    // Make the current arrays what get_batch() prefetches; the constructor and resize()
+    void publish() {
+        live_slots0.store(slots0.data(), std::memory_order_release);
+        live_slots1.store(slots1.data(), std::memory_order_release);
+        live_counts0.store(counts0.data(), std::memory_order_release);
+        live_counts1.store(counts1.data(), std::memory_order_release);
+        live_size.store(table_size, std::memory_order_release);
+    }
+
+    // Resize (double capacity) by splitting buckets: (h % 2n) is either (h % n) or
+    // (h % n) + n, so every record either stays or moves to the same position class
+    // in bucket b + n, and no bucket ends up fuller than before. Records are moved
+    // as they are, large values stay put in the slab.
+    void resize() {
+        int old_capacity = table_size;
+        // allocate (and fault in) the doubled arrays before stopping everyone
+        std::vector<Slot> fresh0((size_t)2 * old_capacity * PROBE_SIZE);
+        std::vector<Slot> fresh1((size_t)2 * old_capacity * PROBE_SIZE);
+        lock_all();
+        if (table_size != old_capacity) { // someone else already resized
+            unlock_all();
+            return;
+        }
+        std::cerr << "Resize\n";
+        table_size *= 2;
+        std::vector<uint8_t> fresh_counts0(table_size, 0);
+        std::vector<uint8_t> fresh_counts1(table_size, 0);
+        for (int b = 0; b < old_capacity; b++) {
+            for (int k = 0; k < counts0[b]; k++) {
+                Slot& s = slots0[(size_t)b * PROBE_SIZE + k];
+                int h = hash0(s.key);
+                fresh0[(size_t)h * PROBE_SIZE + fresh_counts0[h]++] = std::move(s);
+            }
+            for (int k = 0; k < counts1[b]; k++) {
+                Slot& s = slots1[(size_t)b * PROBE_SIZE + k];
+                int h = hash1(s.key);
+                fresh1[(size_t)h * PROBE_SIZE + fresh_counts1[h]++] = std::move(s);
+            }
+        }
+        slots0.swap(fresh0);
+        slots1.swap(fresh1);
+        counts0.swap(fresh_counts0);
+        counts1.swap(fresh_counts1);
+        publish();
+        unlock_all();
+        // the old arrays are freed here, after the table is released
+    }
+
+    // Fig. 13.27 of the textbook, as in StripedCuckooHashSet::relocate(): move the oldest
+    // record of bucket (i, hi) to its other bucket until (i, hi) is below THRESHOLD.
+    // n is the table size hi was computed under.
+    bool relocate(int i, int hi, int n) {
+        int j = 1 - i;
+        for (int round = 0; round < LIMIT; round++) {
+            // the front key is read under bucket (i, hi)'s stripe, which is one of its own locks
+            std::mutex& stripe = (i == 0 ? locks0[hi % locks0.size()] : locks1[hi % locks1.size()]);
+            stripe.lock();
+            if (table_size != n) { stripe.unlock(); return true; } // a resize made room
+            if (count(i, hi) < THRESHOLD) { stripe.unlock(); return true; }
+            K y = bucket(i, hi)[0].key;
+            stripe.unlock();
+
+            acquire(y);
+            if (table_size != n) { release(y); return true; }
+            int hj = (j == 0) ? hash0(y) : hash1(y);
+            Slot* iSet = bucket(i, hi);
+            int k = 0;
+            while (k < count(i, hi) && !(iSet[k].key == y)) k++;
+            if (k < count(i, hi)) {
+                if (count(j, hj) < THRESHOLD) {
+                    push_back(j, hj, erase(i, hi, k));
+                    release(y);
+                    return true;
+                } else if (count(j, hj) < PROBE_SIZE) {
+                    push_back(j, hj, erase(i, hi, k));
+                    i = 1 - i; hi = hj; j = 1 - j;
+                } else { // jSet is full, y stays where it is
+                    release(y);
+                    return false;
+                }
+            } else if (count(i, hi) < THRESHOLD) { // another thread removed y
+                release(y);
+                return true;
+            }
+            release(y);
+        }
+        return false; // Reached LIMIT rounds, trigger resize
+    }
+
+    // put() and insert_if_absent(): one pass under key's stripes finds an existing entry
+    // or places the new one, relocation and resize happen after the locks are dropped
+    bool insert(const K& key, const V& value, bool overwrite) {
+        while (true) {
+            int i = -1, h = -1; // bucket to relocate from
+            acquire(key);
+            int n = table_size;
+            if (Slot* s = find(key)) {
+                if (overwrite) load(*s) = value;
+                release(key);
+                return false;
+            }
+            int h0 = hash0(key);
+            int h1 = hash1(key);
+            if (count(0, h0) < THRESHOLD) {
+                push_back(0, h0, Slot{key, store(value)});
+            } else if (count(1, h1) < THRESHOLD) {
+                push_back(1, h1, Slot{key, store(value)});
+            } else if (count(0, h0) < PROBE_SIZE) {
+                push_back(0, h0, Slot{key, store(value)}); i = 0; h = h0;
+            } else if (count(1, h1) < PROBE_SIZE) {
+                push_back(1, h1, Slot{key, store(value)}); i = 1; h = h1;
+            } else { // both buckets full, grow and try again
+                release(key);
+                resize();
+                continue;
+            }
+            release(key);
+            // key is stored either way, relocation only makes room for later inserts
+            if (i != -1 && !relocate(i, h, n)) resize();
+            return true;
+        }
+    }
+
+    // Every table size must stay a multiple of the lock count (see locks0), so the
+    // requested size is rounded up to a multiple of min(size, num_locks)
+    static int striped_size(int size, int num_locks) {
+        if (size <= 0 || num_locks <= 0) throw std::invalid_argument("bad table geometry");
+        int n = std::min(size, num_locks);
+        return (size + n - 1) / n * n;
+    }
+
+    // Bucket fill counts are 8-bit
+    static int checked_probe_size(int probe_size) {
+        if (probe_size <= 0 || probe_size > 255) throw std::invalid_argument("probe_size must be 1..255");
+        return probe_size;
+    }
+
+public:
+    StripedCuckooHashMap(int size, int limit, int probe_size, int threshold, int num_locks = 1024)
+        : LIMIT(limit),
+          table_size(striped_size(size, num_locks)),
+          PROBE_SIZE(checked_probe_size(probe_size)),
+          THRESHOLD(threshold),
+          slots0((size_t)table_size * PROBE_SIZE),
+          slots1((size_t)table_size * PROBE_SIZE),
+          counts0(table_size, 0),
+          counts1(table_size, 0),
+          locks0(std::min(size, num_locks)),
+          locks1(std::min(size, num_locks)),
+          rng(std::mt19937(std::random_device{}())) {
+        std::uniform_int_distribution<size_t> dist;
+        seed = dist(rng);
+        seed1 = dist(rng);
+        publish();
+    }
+
+    ~StripedCuckooHashMap() {
+        if constexpr (!INLINE_VALUE) {
+            for (int b = 0; b < table_size; b++) {
+                for (int k = 0; k < counts0[b]; k++) drop(bucket(0, b)[k]);
+                for (int k = 0; k < counts1[b]; k++) drop(bucket(1, b)[k]);
+            }
+        }
+    }
+
+    bool contains(const K& key) {
+        acquire(key);
+        bool res = find(key) != nullptr;
+        release(key);
+        return res;
+    }
+
+    std::optional<V> get(const K& key) {
+        acquire(key);
+        std::optional<V> res;
+        if (Slot* s = find(key)) res = load(*s);
+        release(key);
+        return res;
+    }
+
+    // Insert or overwrite. Returns true if key was not present before.
+    bool put(const K& key, const V& value) {
+        return insert(key, value, true);
+    }
+
+    // Insert only if key is missing, the existing value is left alone. Returns true if
+    // value was inserted. Lookup and insert happen under one acquisition of key's stripes.
+    bool insert_if_absent(const K& key, const V& value) {
+        return insert(key, value, false);
+    }
+
+    // Replace key's value with desired if it equals expected. On a mismatch expected is set
+    // to the current value; if key is absent expected is left as it is. Returns true on success.
+    bool compare_exchange(const K& key, V& expected, const V& desired) {
+        acquire(key);
+        bool res = false;
+        if (Slot* s = find(key)) {
+            V& current = load(*s);
+            if (current == expected) {
+                current = desired;
+                res = true;
+            } else {
+                expected = current;
+            }
+        }
+        release(key);
+        return res;
+    }
+
+    // Apply fn(value&) in place if key is present and pred(const value&) holds, both
+    // under key's stripe locks (so fn must not call back into the map).
+    // Returns true if fn ran.
+    template <typename Pred, typename Fn>
+    bool update_if(const K& key, Pred pred, Fn fn) {
+        acquire(key);
+        bool res = false;
+        if (Slot* s = find(key)) {
+            V& current = load(*s);
+            if (pred(static_cast<const V&>(current))) {
+                fn(current);
+                res = true;
+            }
+        }
+        release(key);
+        return res;
+    }
+
+    bool remove(const K& key) {
+        acquire(key);
+        int h0 = hash0(key);
+        int h1 = hash1(key);
+        for (int t = 0; t < 2; t++) {
+            int h = (t == 0) ? h0 : h1;
+            Slot* b = bucket(t, h);
+            for (int k = 0; k < count(t, h); k++) {
+                if (b[k].key == key) {
+                    Slot s = erase(t, h, k);
+                    drop(s);
+                    release(key);
+                    return true;
+                }
+            }
+        }
+        release(key);
+        return false;
+    }
+
+    // Look up n keys: the locks, fill counts and slots of a group of keys are prefetched
+    // before the first of them is locked, so their cache misses overlap. The bucket
+    // arrays are found through the live_ pointers (see publish()), the lookups
+    // themselves go through get() under the locks. out[k] is empty if keys[k] is absent.
+    void get_batch(const K* keys, int n, std::optional<V>* out) {
+        constexpr int GROUP = 16;
+        for (int base = 0; base < n; base += GROUP) {
+            int m = std::min(GROUP, n - base);
+            size_t size = live_size.load(std::memory_order_acquire);
+            Slot* s0 = live_slots0.load(std::memory_order_acquire);
+            Slot* s1 = live_slots1.load(std::memory_order_acquire);
+            uint8_t* c0 = live_counts0.load(std::memory_order_acquire);
+            uint8_t* c1 = live_counts1.load(std::memory_order_acquire);
+            for (int k = 0; k < m; k++) {
+                size_t r0 = raw0(keys[base + k]), r1 = raw1(keys[base + k]);
+                size_t h0 = r0 % size, h1 = r1 % size;
+                __builtin_prefetch(&locks0[r0 % locks0.size()]);
+                __builtin_prefetch(&locks1[r1 % locks1.size()]);
+                __builtin_prefetch(&c0[h0]);
+                __builtin_prefetch(&c1[h1]);
+                __builtin_prefetch(&s0[h0 * PROBE_SIZE]);
+                __builtin_prefetch(&s1[h1 * PROBE_SIZE]);
+            }
+            for (int k = 0; k < m; k++) out[base + k] = get(keys[base + k]);
+        }
+    }
+
+    // Grow until n entries fit below THRESHOLD, so a bulk load does not resize midway
+    void reserve(int n) {
+        while ((long)n > 2L * table_size * THRESHOLD) resize();
+    }
+
+    // Parallel bulk load. Rows are first partitioned by their table 0 lock stripe (each
+    // worker partitions a slice), then worker p inserts partition p, so no two workers
+    // ever wait on the same table 0 stripe.
+    void bulk_build(const std::vector<std::pair<K, V>>& rows, int num_threads) {
+        reserve(size() + (int)rows.size());
+        std::vector<std::vector<std::vector<const std::pair<K, V>*>>> parts(
+            num_threads, std::vector<std::vector<const std::pair<K, V>*>>(num_threads));
+        std::vector<std::thread> workers;
+        for (int t = 0; t < num_threads; t++) {
+            workers.emplace_back([&, t]() {
+                size_t from = rows.size() * t / num_threads, to = rows.size() * (t + 1) / num_threads;
+                for (size_t r = from; r < to; r++)
+                    parts[t][raw0(rows[r].first) % locks0.size() % num_threads].push_back(&rows[r]);
+            });
+        }
+        for (auto& w : workers) w.join();
+        workers.clear();
+        for (int p = 0; p < num_threads; p++) {
+            workers.emplace_back([&, p]() {
+                for (int t = 0; t < num_threads; t++)
+                    for (auto* row : parts[t][p]) put(row->first, row->second);
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+
+    int size() {
+        int total = 0;
+        for (uint8_t c : counts0) total += c;
+        for (uint8_t c : counts1) total += c;
+        return total;
+    }
+
+    void populate(int n, const V& value) {
+        std::uniform_int_distribution<K> dist(0, n * 8);
+        for (int i = 0; i < n; ++i)
+            while (!put(dist(rng), value)) {}
+    }
+
+    static constexpr bool stores_inline() {
+        return INLINE_VALUE;
+    }
+};
+
+// Parallel hash join: build rows are bulk loaded into a map (build keys must be unique,
+// e.g. a primary key), probe rows are split over num_threads workers and looked up in
+// vectors of JOIN_BATCH through get_batch(). Every match becomes emit(thread, probe row,
+// build value); give each worker its own output buffer, emit is never synchronized.
+constexpr int JOIN_BATCH = 1024;
+// Fill of the built map: rows over all slots of both tables. Sized to just fit below
+// THRESHOLD, a bulk load usually ends in one resize when a kick finds a full bucket.
+constexpr double JOIN_LOAD = 0.4;
+
+template <typename K, typename V, typename Row, typename KeyOf, typename Emit>
+void hash_join_probe(StripedCuckooHashMap<K, V>& built, const std::vector<Row>& probe, KeyOf key_of,
+                     int num_threads, Emit emit) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::vector<K> keys(JOIN_BATCH);
+            std::vector<std::optional<V>> found(JOIN_BATCH);
+            size_t from = probe.size() * t / num_threads, to = probe.size() * (t + 1) / num_threads;
+            for (size_t base = from; base < to; base += JOIN_BATCH) {
+                int n = (int)std::min<size_t>(JOIN_BATCH, to - base);
+                for (int k = 0; k < n; k++) keys[k] = key_of(probe[base + k]);
+                built.get_batch(keys.data(), n, found.data());
+                for (int k = 0; k < n; k++)
+                    if (found[k]) emit(t, probe[base + k], *found[k]);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+}
+
+// Build and probe in one call, matches collected into out[thread]
+template <typename K, typename V, typename Row, typename KeyOf>
+void hash_join(const std::vector<std::pair<K, V>>& build, const std::vector<Row>& probe, KeyOf key_of,
+               int num_threads, std::vector<std::vector<std::pair<Row, V>>>& out,
+               int limit = 100, int probe_size = 4, int threshold = 2) {
+    int buckets = (int)(build.size() / (JOIN_LOAD * 2 * probe_size)) + 1; // rounded to the lock count
+
+    StripedCuckooHashMap<K, V> built(buckets, limit, probe_size, threshold);
+    built.bulk_build(build, num_threads);
+    out.assign(num_threads, {});
+    hash_join_probe(built, probe, key_of, num_threads, [&](int t, const Row& row, const V& value) {
+        out[t].emplace_back(row, value);
+    });
+}
+
+// 64 byte record, too big for a slot: stored in the slab, kicks move a 4 byte handle
+struct OrderRecord {
+    long order_id;
+    long customer_id;
+    double total_price;
+    int status;
+    char comment[36];
+};
+
+template <typename V>
+double run_benchmark(int initial_size, int limit, int probe_size, int threshold,
+                     int num_threads, int total_ops, double insert_ratio, double remove_ratio,
+                     const V& value, long& expected, long& actual) {
+    StripedCuckooHashMap<int, V> map(initial_size, limit, probe_size, threshold);
+    map.populate(initial_size * 0.5, value);
+
+    int ops_per_thread = total_ops / num_threads;
+    std::vector<long> computed_size(num_threads, 0);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(std::random_device{}());
+            std::uniform_real_distribution<double> op_dist(0.0, 1.0);
+            std::uniform_int_distribution<int> key_dist(0, initial_size * 4);
+            for (int i = 0; i < ops_per_thread; ++i) {
+                double op_choice = op_dist(rng);
+                int key = key_dist(rng);
+                if (op_choice < insert_ratio) {
+                    if (map.put(key, value))
+                        computed_size[t]++;
+                } else if (op_choice < insert_ratio + remove_ratio) {
+                    if (map.remove(key))
+                        computed_size[t]--;
+                } else {
+                    map.get(key);
+                }
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end_time - start_time;
+
+    expected = initial_size / 2;
+    for (long c : computed_size) expected += c;
+    actual = map.size();
+    return duration.count();
+}
+
+int main() {
+    int initial_size = 1 << 18;  // buckets per table
+    int limit = 100;
+    int num_threads = 16;
+    int total_ops = 1000000;
+    double insert_ratio = 0.40;  // insert heavy, so kicks and resizes dominate
+    double remove_ratio = 0.10;
+    int probe_size = 4;
+    int threshold = 2;
+
+    std::cout << "Inline long values: " << StripedCuckooHashMap<int, long>::stores_inline()
+              << ", 64 byte records inline: " << StripedCuckooHashMap<int, OrderRecord>::stores_inline() << "\n";
+    std::cout << "Starting concurrent benchmark...\n";
+
+    long expected = 0, actual = 0;
+    double t_small = run_benchmark<long>(initial_size, limit, probe_size, threshold, num_threads,
+                                         total_ops, insert_ratio, remove_ratio, 42L, expected, actual);
+    std::cout << "long values:         " << t_small << " seconds, size " << actual << " (expected " << expected << ")\n";
+
+    OrderRecord record{1, 2, 3.0, 4, "slab stored"};
+    double t_large = run_benchmark<OrderRecord>(initial_size, limit, probe_size, threshold, num_threads,
+                                                total_ops, insert_ratio, remove_ratio, record, expected, actual);
+    std::cout << "OrderRecord values:  " << t_large << " seconds, size " << actual << " (expected " << expected << ")\n";
+
+    // Conditional updates: counters bumped with compare_exchange retries and update_if,
+    // every key created with insert_if_absent. Nothing may be lost.
+    int counter_keys = 1024;
+    StripedCuckooHashMap<int, long> counters(counter_keys, limit, probe_size, threshold);
+    auto cas_start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<int> key_dist(0, counter_keys - 1);
+            for (int i = 0; i < total_ops / num_threads; ++i) {
+                int key = key_dist(rng);
+                counters.insert_if_absent(key, 0);
+                if (i & 1) {
+                    long seen = 0;
+                    while (!counters.compare_exchange(key, seen, seen + 1)) {}
+                } else {
+                    counters.update_if(key, [](const long&) { return true; }, [](long& v) { v++; });
+                }
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    std::chrono::duration<double> cas_time = std::chrono::high_resolution_clock::now() - cas_start;
+    long total = 0;
+    for (int k = 0; k < counter_keys; k++) total += counters.get(k).value_or(0);
+    std::cout << "Counter updates:     " << cas_time.count() << " seconds, total " << total
+              << " (expected " << (long)(total_ops / num_threads) * num_threads << ")\n";
+
+    // TPC-H like joins (scale factor 0.1 row counts). Q3 style: lineitem joined to orders
+    // on l_orderkey, revenue of lines shipped after the cutoff for orders placed before it.
+    // Then orders joined to customer, whose 64 byte rows go through the slab.
+    bool tpch_join = false;
+    if (tpch_join) {
+        struct Order { int custkey; int orderdate; double totalprice; }; // 16 bytes, stored inline
+        struct LineItem { int orderkey; int shipdate; double extendedprice; double discount; };
+        struct Customer { int custkey; int nationkey; double acctbal; char mktsegment[16]; char name[32]; };
+        int num_customers = 15000, num_orders = 150000, cutoff = 1200; // dates are days since 1992
+        std::mt19937 rng(375);
+        std::vector<std::pair<int, Order>> orders;
+        std::vector<LineItem> lineitems;
+        std::vector<std::pair<int, Customer>> customers;
+        for (int c = 1; c <= num_customers; c++)
+            customers.push_back({c, Customer{c, (int)(rng() % 25), (double)(rng() % 10000), "BUILDING", "Customer"}});
+        for (int o = 1; o <= num_orders; o++) {
+            int orderkey = o * 4; // sparse keys, like TPC-H
+            Order order{(int)(rng() % num_customers) + 1, (int)(rng() % 2400), 0.0};
+            int lines = 1 + rng() % 7;
+            for (int l = 0; l < lines; l++) {
+                LineItem li{orderkey, order.orderdate + 1 + (int)(rng() % 120), 900.0 + rng() % 100000, (rng() % 11) / 100.0};
+                order.totalprice += li.extendedprice;
+                lineitems.push_back(li);
+            }
+            orders.push_back({orderkey, order});
+        }
+        std::shuffle(lineitems.begin(), lineitems.end(), rng);
+
+        auto join_start = std::chrono::high_resolution_clock::now();
+        StripedCuckooHashMap<int, Order> order_map(num_orders / (JOIN_LOAD * 2 * probe_size) + 1, limit, probe_size, threshold);
+        order_map.bulk_build(orders, num_threads);
+        std::chrono::duration<double> build_time = std::chrono::high_resolution_clock::now() - join_start;
+        std::vector<double> revenue(num_threads, 0.0);
+        std::vector<long> matches(num_threads, 0);
+        hash_join_probe(order_map, lineitems, [](const LineItem& li) { return li.orderkey; }, num_threads,
+                        [&](int t, const LineItem& li, const Order& o) {
+                            matches[t]++;
+                            if (o.orderdate < cutoff && li.shipdate > cutoff)
+                                revenue[t] += li.extendedprice * (1 - li.discount);
+                        });
+        std::chrono::duration<double> join_time = std::chrono::high_resolution_clock::now() - join_start;
+        long matched = 0;
+        double total_revenue = 0;
+        for (int t = 0; t < num_threads; t++) { matched += matches[t]; total_revenue += revenue[t]; }
+        std::cout << "lineitem x orders:   " << join_time.count() << " seconds (build " << build_time.count()
+                  << "), " << matched << " of " << lineitems.size() << " lines matched, revenue " << (long)total_revenue << "\n";
+
+        auto cust_start = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<std::pair<std::pair<int, Order>, Customer>>> order_customer;
+        hash_join(customers, orders, [](const std::pair<int, Order>& o) { return o.second.custkey; },
+                  num_threads, order_customer, limit, probe_size, threshold);
+        std::chrono::duration<double> cust_time = std::chrono::high_resolution_clock::now() - cust_start;
+        size_t pairs = 0;
+        for (auto& part : order_customer) pairs += part.size();
+        std::cout << "orders x customer:   " << cust_time.count() << " seconds, " << pairs << " of "
+                  << orders.size() << " orders matched\n";
+    }
+    std::cout << "Benchmark complete.\n";
+    return 0;
+}
+
+// g++ -std=c++17 -O2 -pthread stripedCuckooHashMap.cpp -o striped_cuckoo_map
+//./striped_cuckoo_map
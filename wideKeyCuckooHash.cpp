@@ -0,0 +1,412 @@
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <stdexcept>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// g++ -std=c++17 -O2 -mavx2 wideKeyCuckooHash.cpp -o wide_key_cuckoo_hash
+
+// 128 bit key (a UUID), compared and hashed as two 64 bit words
+struct Uuid {
+    uint64_t lo;
+    uint64_t hi;
+
+    bool operator==(const Uuid& o) const {
+        return lo == o.lo && hi == o.hi;
+    }
+};
+
+// Cuckoo set for fixed width keys (uint64_t or Uuid) stored inline, with no std::hash,
+// no std::optional and no fingerprints. Every bucket is one 64 byte cache line: SLOTS
+// keys (7 uint64_t or 3 Uuid, oldest first) and the slot count in the room left over.
+// Buckets are 64 byte aligned so a lookup is two aligned 32 byte loads per bucket; with
+// AVX2 every slot of a bucket is compared against the whole key at once and the result
+// masked by the count, so there is no per-slot branch. Without AVX2 the same find() is a
+// plain loop over the slots.
+template <typename K>
+class WideKeyCuckooHashSet {
+    static_assert(std::is_same<K, uint64_t>::value || std::is_same<K, Uuid>::value,
+                  "keys are uint64_t or Uuid");
+
+private:
+    static constexpr bool IS_UUID = std::is_same<K, Uuid>::value;
+    static constexpr int SLOTS = 64 / sizeof(K) - 1;
+    static constexpr int BATCH = 16; // keys hashed and prefetched together by the batch paths
+    static constexpr size_t MAX_BUCKETS = (size_t)1 << 32; // indices are 32 bit hashes
+    static constexpr int WORDS = sizeof(K) / 4; // 32 bit words hashed per key
+
+    struct alignas(64) Bucket {
+        K keys[SLOTS];
+        uint64_t count;
+    };
+    static_assert(sizeof(Bucket) == 64, "a bucket is one cache line");
+
+    int LIMIT;               // Max displacements before resize
+    uint64_t mask;           // buckets per table - 1
+    int shift;               // 32 - log2(buckets per table)
+    std::vector<Bucket> table0;
+    std::vector<Bucket> table1;
+    size_t num_elements = 0;
+    uint32_t mul0[WORDS], mul1[WORDS]; // random odd multipliers, one per key word and table
+    std::mt19937_64 rng;
+
+    // Multiply-shift in 32 bit arithmetic: the key's 32 bit words times the table's
+    // multipliers, summed mod 2^32, and the top log2(buckets) bits of that are the
+    // bucket. Two keys collide with probability about 2 / buckets for any multipliers
+    // drawn, and everything fits 32 bit lanes, so hash_batch() does 8 keys per register.
+    static uint32_t multiply_shift(const K& x, const uint32_t* mul) {
+        uint32_t w[WORDS];
+        std::memcpy(w, &x, sizeof(K));
+        uint32_t h = 0;
+        for (int k = 0; k < WORDS; k++) h += w[k] * mul[k];
+        return h;
+    }
+
+    uint64_t index0(const K& x) const {
+        return (uint64_t)multiply_shift(x, mul0) >> shift;
+    }
+
+    uint64_t index1(const K& x) const {
+        return (uint64_t)multiply_shift(x, mul1) >> shift;
+    }
+
+    std::vector<Bucket>& table(int t) {
+        return t == 0 ? table0 : table1;
+    }
+
+    // Slot of x in b, or -1
+    static int find_scalar(const Bucket& b, const K& x) {
+        for (int k = 0; k < (int)b.count; k++)
+            if (b.keys[k] == x) return k;
+        return -1;
+    }
+
+    static int find(const Bucket& b, const K& x) {
+#ifdef __AVX2__
+        const __m256i* p = reinterpret_cast<const __m256i*>(&b);
+        __m256i v;
+        if constexpr (IS_UUID) v = _mm256_set_epi64x(x.hi, x.lo, x.hi, x.lo);
+        else v = _mm256_set1_epi64x(x);
+        // one bit per 64 bit lane of the line; for uint64_t lane 7 is the count, for Uuid
+        // lanes 6 and 7 are the count and padding, the occupancy mask drops them
+        unsigned m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_load_si256(p), v)))
+                   | _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_load_si256(p + 1), v))) << 4;
+        if constexpr (IS_UUID) {
+            m &= m >> 1; // both halves of a slot must match
+            m = (m & 1) | ((m >> 1) & 2) | ((m >> 2) & 4);
+        }
+        m &= (1u << b.count) - 1;
+        return m ? __builtin_ctz(m) : -1;
+#else
+        return find_scalar(b, x);
+#endif
+    }
+
+    static void erase(Bucket& b, int k) {
+        for (int m = k + 1; m < (int)b.count; m++) b.keys[m - 1] = b.keys[m];
+        b.count--;
+    }
+
+    // Place x with buckets i0 and i1, kicking oldest entries to their other bucket. On
+    // failure the homeless key is returned in homeless and false comes back.
+    bool place(K x, uint64_t i0, uint64_t i1, K& homeless) {
+        Bucket* b0 = &table0[i0];
+        if (b0->count < SLOTS) { b0->keys[b0->count++] = x; return true; }
+        Bucket* b1 = &table1[i1];
+        if (b1->count < SLOTS) { b1->keys[b1->count++] = x; return true; }
+        int t = 0;
+        Bucket* b = b0;
+        for (int round = 0; round < LIMIT; round++) {
+            K v = b->keys[0];
+            erase(*b, 0);
+            b->keys[b->count++] = x;
+            x = v;
+            t = 1 - t;
+            b = &table(t)[t == 0 ? index0(v) : index1(v)];
+            if (b->count < SLOTS) { b->keys[b->count++] = x; return true; }
+        }
+        homeless = x;
+        return false;
+    }
+
+    bool place(K x, K& homeless) {
+        return place(x, index0(x), index1(x), homeless);
+    }
+
+    // i0[j] and i1[j] for keys[0..n), n <= BATCH. With AVX2, 8 keys per step: each
+    // register holds whole keys (4 uint64_t or 2 Uuid), _mm256_mullo_epi32 multiplies
+    // every word by its table's multiplier, horizontal adds sum the words of a key, and
+    // a permute puts the 8 sums back in key order before the shift. Matches index0()
+    // and index1() bit for bit; a tail of fewer than 8 keys goes through them.
+    void hash_batch(const K* keys, int n, uint32_t* i0, uint32_t* i1) const {
+        int j = 0;
+#ifdef __AVX2__
+        __m128i count = _mm_cvtsi32_si128(shift);
+        __m256i m0, m1;
+        if constexpr (IS_UUID) {
+            m0 = _mm256_setr_epi32(mul0[0], mul0[1], mul0[2], mul0[3], mul0[0], mul0[1], mul0[2], mul0[3]);
+            m1 = _mm256_setr_epi32(mul1[0], mul1[1], mul1[2], mul1[3], mul1[0], mul1[1], mul1[2], mul1[3]);
+        } else {
+            m0 = _mm256_setr_epi32(mul0[0], mul0[1], mul0[0], mul0[1], mul0[0], mul0[1], mul0[0], mul0[1]);
+            m1 = _mm256_setr_epi32(mul1[0], mul1[1], mul1[0], mul1[1], mul1[0], mul1[1], mul1[0], mul1[1]);
+        }
+        for (; j + 8 <= n; j += 8) {
+            const __m256i* p = reinterpret_cast<const __m256i*>(keys + j);
+            __m256i h0, h1;
+            if constexpr (IS_UUID) {
+                // hadd twice leaves keys 0 2 4 6 in the low lane and 1 3 5 7 in the high one
+                __m256i v0 = _mm256_loadu_si256(p), v1 = _mm256_loadu_si256(p + 1);
+                __m256i v2 = _mm256_loadu_si256(p + 2), v3 = _mm256_loadu_si256(p + 3);
+                __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+                h0 = _mm256_hadd_epi32(_mm256_hadd_epi32(_mm256_mullo_epi32(v0, m0), _mm256_mullo_epi32(v1, m0)),
+                                       _mm256_hadd_epi32(_mm256_mullo_epi32(v2, m0), _mm256_mullo_epi32(v3, m0)));
+                h1 = _mm256_hadd_epi32(_mm256_hadd_epi32(_mm256_mullo_epi32(v0, m1), _mm256_mullo_epi32(v1, m1)),
+                                       _mm256_hadd_epi32(_mm256_mullo_epi32(v2, m1), _mm256_mullo_epi32(v3, m1)));
+                h0 = _mm256_permutevar8x32_epi32(h0, order);
+                h1 = _mm256_permutevar8x32_epi32(h1, order);
+            } else {
+                // one hadd leaves keys 0 1 4 5 2 3 6 7, swapping the middle 64 bit lanes fixes it
+                __m256i v0 = _mm256_loadu_si256(p), v1 = _mm256_loadu_si256(p + 1);
+                h0 = _mm256_hadd_epi32(_mm256_mullo_epi32(v0, m0), _mm256_mullo_epi32(v1, m0));
+                h1 = _mm256_hadd_epi32(_mm256_mullo_epi32(v0, m1), _mm256_mullo_epi32(v1, m1));
+                h0 = _mm256_permute4x64_epi64(h0, _MM_SHUFFLE(3, 1, 2, 0));
+                h1 = _mm256_permute4x64_epi64(h1, _MM_SHUFFLE(3, 1, 2, 0));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(i0 + j), _mm256_srl_epi32(h0, count));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(i1 + j), _mm256_srl_epi32(h1, count));
+        }
+#endif
+        for (; j < n; j++) {
+            i0[j] = index0(keys[j]);
+            i1[j] = index1(keys[j]);
+        }
+    }
+
+    void set_buckets(size_t buckets) {
+        mask = buckets - 1;
+        shift = 32 - __builtin_ctzll(buckets);
+        table0.assign(buckets, Bucket{});
+        table1.assign(buckets, Bucket{});
+    }
+
+    // Double both tables (again if the rebuild fails) and place every key again
+    void resize() {
+        std::cerr << "Resize\n";
+        std::vector<K> keys;
+        keys.reserve(num_elements);
+        for_each([&](const K& x) { keys.push_back(x); });
+        size_t buckets = 2 * (mask + 1);
+        while (true) {
+            if (buckets > MAX_BUCKETS) throw std::length_error("wide key table cannot grow further");
+            set_buckets(buckets);
+            bool ok = true;
+            K homeless;
+            for (const K& x : keys)
+                if (!place(x, homeless)) { ok = false; break; }
+            if (ok) return;
+            buckets *= 2;
+        }
+    }
+
+public:
+    // size: buckets per table, rounded up to a power of two (at most MAX_BUCKETS)
+    WideKeyCuckooHashSet(size_t size, int limit)
+        : LIMIT(limit),
+          rng(std::random_device{}()) {
+        size_t buckets = 2;
+        while (buckets < size && buckets < MAX_BUCKETS) buckets *= 2;
+        for (int k = 0; k < WORDS; k++) {
+            mul0[k] = (uint32_t)rng() | 1;
+            mul1[k] = (uint32_t)rng() | 1;
+        }
+        set_buckets(buckets);
+    }
+
+    bool contains(const K& x) const {
+        return find(table0[index0(x)], x) >= 0 || find(table1[index1(x)], x) >= 0;
+    }
+
+    // The same lookup with the slot loop, for comparison
+    bool contains_scalar(const K& x) const {
+        return find_scalar(table0[index0(x)], x) >= 0 || find_scalar(table1[index1(x)], x) >= 0;
+    }
+
+    bool add(const K& x) {
+        if (contains(x)) return false;
+        num_elements++;
+        K homeless;
+        if (place(x, homeless)) return true;
+        resize(); // homeless is already counted but in no bucket
+        while (!place(homeless, homeless)) resize();
+        return true;
+    }
+
+    // contains() for keys[0..n) into out[0..n). Keys are hashed BATCH at a time and
+    // all of their buckets prefetched before the first one is probed.
+    void contains_batch(const K* keys, size_t n, bool* out) const {
+        uint32_t i0[BATCH], i1[BATCH];
+        for (size_t base = 0; base < n; base += BATCH) {
+            int m = (int)std::min<size_t>(BATCH, n - base);
+            hash_batch(keys + base, m, i0, i1);
+            for (int j = 0; j < m; j++) {
+                __builtin_prefetch(&table0[i0[j]]);
+                __builtin_prefetch(&table1[i1[j]]);
+            }
+            for (int j = 0; j < m; j++)
+                out[base + j] = find(table0[i0[j]], keys[base + j]) >= 0 || find(table1[i1[j]], keys[base + j]) >= 0;
+        }
+    }
+
+    // add() for keys[0..n), returns how many were new. Same batching as contains_batch;
+    // once a resize changes the geometry the rest of that batch goes through add().
+    size_t add_batch(const K* keys, size_t n) {
+        uint32_t i0[BATCH], i1[BATCH];
+        size_t added = 0;
+        for (size_t base = 0; base < n; base += BATCH) {
+            int m = (int)std::min<size_t>(BATCH, n - base);
+            hash_batch(keys + base, m, i0, i1);
+            for (int j = 0; j < m; j++) {
+                __builtin_prefetch(&table0[i0[j]], 1);
+                __builtin_prefetch(&table1[i1[j]], 1);
+            }
+            uint64_t batch_mask = mask;
+            for (int j = 0; j < m; j++) {
+                const K& x = keys[base + j];
+                if (mask != batch_mask) { added += add(x); continue; }
+                if (find(table0[i0[j]], x) >= 0 || find(table1[i1[j]], x) >= 0) continue;
+                num_elements++;
+                added++;
+                K homeless;
+                if (place(x, i0[j], i1[j], homeless)) continue;
+                resize();
+                while (!place(homeless, homeless)) resize();
+            }
+        }
+        return added;
+    }
+
+    bool remove(const K& x) {
+        for (int t = 0; t < 2; t++) {
+            Bucket& b = table(t)[t == 0 ? index0(x) : index1(x)];
+            int k = find(b, x);
+            if (k >= 0) {
+                erase(b, k);
+                num_elements--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (const auto* t : {&table0, &table1})
+            for (const Bucket& b : *t)
+                for (int k = 0; k < (int)b.count; k++) fn(b.keys[k]);
+    }
+
+    size_t size() const {
+        return num_elements;
+    }
+
+    size_t capacity() const {
+        return 2 * SLOTS * (mask + 1);
+    }
+
+    size_t memory_bytes() const {
+        return (table0.size() + table1.size()) * sizeof(Bucket);
+    }
+};
+
+template <typename K>
+K random_key(std::mt19937_64& rng) {
+    if constexpr (std::is_same<K, Uuid>::value) {
+        // version 4 UUID: random apart from the version and variant bits
+        Uuid u{rng(), rng()};
+        u.hi = (u.hi & ~0xf000ull) | 0x4000ull;
+        u.lo = (u.lo & ~(3ull << 62)) | (2ull << 62);
+        return u;
+    } else {
+        return rng();
+    }
+}
+
+template <typename K>
+void run_benchmark(const char* label, size_t buckets, size_t n, int limit) {
+    WideKeyCuckooHashSet<K> set(buckets, limit);
+    std::mt19937_64 rng(std::random_device{}());
+    std::vector<K> keys(n), probes(n);
+    for (auto& k : keys) k = random_key<K>(rng);
+    for (auto& k : probes) k = random_key<K>(rng); // misses, barring a 2^-64 collision
+
+    auto build_start = std::chrono::high_resolution_clock::now();
+    for (const K& k : keys) set.add(k);
+    std::chrono::duration<double> build_time = std::chrono::high_resolution_clock::now() - build_start;
+
+    std::shuffle(keys.begin(), keys.end(), rng);
+    auto simd_start = std::chrono::high_resolution_clock::now();
+    size_t found = 0, false_hits = 0;
+    for (const K& k : keys) found += set.contains(k);
+    for (const K& k : probes) false_hits += set.contains(k);
+    std::chrono::duration<double> simd_time = std::chrono::high_resolution_clock::now() - simd_start;
+
+    auto scalar_start = std::chrono::high_resolution_clock::now();
+    size_t found_scalar = 0;
+    for (const K& k : keys) found_scalar += set.contains_scalar(k);
+    for (const K& k : probes) found_scalar += set.contains_scalar(k);
+    std::chrono::duration<double> scalar_time = std::chrono::high_resolution_clock::now() - scalar_start;
+
+    // the same lookups through contains_batch, and a second set built with add_batch
+    std::vector<K> lookups(keys);
+    lookups.insert(lookups.end(), probes.begin(), probes.end());
+    std::unique_ptr<bool[]> out(new bool[lookups.size()]);
+    auto batch_start = std::chrono::high_resolution_clock::now();
+    set.contains_batch(lookups.data(), lookups.size(), out.get());
+    std::chrono::duration<double> batch_time = std::chrono::high_resolution_clock::now() - batch_start;
+    size_t found_batch = std::count(out.get(), out.get() + lookups.size(), true);
+
+    WideKeyCuckooHashSet<K> bulk(buckets, limit);
+    auto bulk_start = std::chrono::high_resolution_clock::now();
+    size_t bulk_added = bulk.add_batch(keys.data(), keys.size());
+    std::chrono::duration<double> bulk_time = std::chrono::high_resolution_clock::now() - bulk_start;
+
+    std::cout << label << "\n";
+    std::cout << "  Elements:          " << set.size() << " / " << set.capacity() << " slots\n";
+    std::cout << "  Bytes per element: " << (double)set.memory_bytes() / set.size() << "\n";
+    std::cout << "  Found:             " << found << ", false hits: " << false_hits
+              << (found_scalar == found + false_hits ? "" : " (scalar lookups disagree)") << "\n";
+    std::cout << "  Build time:        " << build_time.count() << " seconds\n";
+    std::cout << "  Lookup time:       " << simd_time.count() << " seconds ("
+              << 2 * n << " lookups, scalar loop " << scalar_time.count() << ")\n";
+    std::cout << "  Batch lookup time: " << batch_time.count() << " seconds"
+              << (found_batch == found + false_hits ? "" : " (batch lookups disagree)") << "\n";
+    std::cout << "  Bulk build time:   " << bulk_time.count() << " seconds"
+              << (bulk_added == set.size() ? "" : " (bulk build size differs)") << "\n";
+}
+
+int main() {
+    int limit = 500;
+
+    std::cout << "Starting benchmark test(s)...\n";
+#ifdef __AVX2__
+    std::cout << "AVX2 slot compares\n";
+#else
+    std::cout << "Scalar slot compares (build with -mavx2)\n";
+#endif
+    run_benchmark<uint64_t>("uint64_t keys", 1 << 19, 6000000, limit); // 7.3M slots
+    run_benchmark<Uuid>("UUID keys", 1 << 20, 5000000, limit);         // 6.3M slots
+    std::cout << "Benchmark test(s) complete.\n";
+    return 0;
+}
+
+// g++ -std=c++17 -O2 -mavx2 wideKeyCuckooHash.cpp -o wide_key_cuckoo_hash
+// ./wide_key_cuckoo_hash